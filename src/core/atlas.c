@@ -0,0 +1,277 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+#include "matrix.h"
+#include "recolor.h"
+
+// bitmap file and info headers
+#define BITMAP_FILE_HEADER_SIZE 14
+#define BITMAP_INFO_HEADER_SIZE 40
+
+static uint32_t ReadLe (const uint8_t *data, int size)
+{
+	uint32_t value = 0;
+
+	for (int i = size - 1; i >= 0; i--)
+		value = (value << 8) | data[i];
+
+	return value;
+}
+
+bool GlyphBitmapSize (const uint8_t *data, size_t size, int *columns, int *rows)
+{
+	uint32_t offset;
+	uint32_t header_size;
+	uint32_t colors;
+	int32_t width;
+	int32_t height;
+	size_t stride;
+
+	if (size < BITMAP_FILE_HEADER_SIZE + BITMAP_INFO_HEADER_SIZE)
+		return false;
+
+	offset = ReadLe (data + 10, 4);
+	header_size = ReadLe (data + 14, 4);
+	width = (int32_t)ReadLe (data + 18, 4);
+	height = (int32_t)ReadLe (data + 22, 4);
+	colors = ReadLe (data + 46, 4);
+
+	if (data[0] != 'B' || data[1] != 'M' || ReadLe (data + 28, 2) != 8 || ReadLe (data + 30, 4) != 0)
+		return false;
+
+	if (!colors || colors > 256)
+		colors = 256;
+
+	if (width <= 0 || !height || height == INT32_MIN)
+		return false;
+
+	stride = ((size_t)width + 3) & ~(size_t)3;
+
+	if (header_size < BITMAP_INFO_HEADER_SIZE || BITMAP_FILE_HEADER_SIZE + (size_t)header_size + colors * 4 > size || offset + stride * abs (height) > size)
+		return false;
+
+	*columns = width / GLYPH_WIDTH;
+	*rows = abs (height) / GLYPH_HEIGHT;
+
+	return *columns && *rows;
+}
+
+void DecodeGlyphBitmap (const uint8_t *data, uint8_t *saturation, uint8_t *luminance)
+{
+	uint8_t pal_saturation[256] = {0};
+	uint8_t pal_luminance[256] = {0};
+	const uint8_t *quad;
+	const uint8_t *row;
+	uint16_t h, l, s;
+	uint32_t offset = ReadLe (data + 10, 4);
+	uint32_t colors = ReadLe (data + 46, 4);
+	int32_t width = (int32_t)ReadLe (data + 18, 4);
+	int32_t height = (int32_t)ReadLe (data + 22, 4);
+	size_t stride = ((size_t)width + 3) & ~(size_t)3;
+	int plane_width = (width / GLYPH_WIDTH) * GLYPH_WIDTH;
+	int plane_height = (abs (height) / GLYPH_HEIGHT) * GLYPH_HEIGHT;
+	int src_y;
+
+	if (!colors || colors > 256)
+		colors = 256;
+
+	// recoloring keeps saturation and luminance, so convert the
+	// palette once and only store those two values for every pixel
+	for (uint32_t i = 0; i < colors; i++)
+	{
+		quad = data + BITMAP_FILE_HEADER_SIZE + ReadLe (data + 14, 4) + i * 4;
+
+		RgbToHls (quad[2] | (quad[1] << 8) | ((uint32_t)quad[0] << 16), &h, &l, &s);
+
+		pal_saturation[i] = (uint8_t)s;
+		pal_luminance[i] = (uint8_t)l;
+	}
+
+	for (int y = 0; y < plane_height; y++)
+	{
+		// positive height means a bottom-up bitmap
+		src_y = (height > 0) ? (height - 1 - y) : y;
+		row = data + offset + (size_t)src_y * stride;
+
+		for (int x = 0; x < plane_width; x++)
+		{
+			saturation[(size_t)y * plane_width + x] = pal_saturation[row[x]];
+			luminance[(size_t)y * plane_width + x] = pal_luminance[row[x]];
+		}
+	}
+}
+
+void MeasureAtlasTones (PATLAS_TONE tone, const uint8_t *saturation, const uint8_t *luminance, int columns, int cell_width, int cell_height)
+{
+	uint32_t count[256];
+	uint32_t sum[256];
+	uint32_t total;
+	uint32_t rank;
+	size_t width = (size_t)columns * cell_width;
+	size_t offset;
+	int value;
+
+	for (int level = 0; level < ATLAS_LEVELS; level++)
+	{
+		memset (count, 0, sizeof (count));
+		memset (sum, 0, sizeof (sum));
+		memset (&tone[level], 0, sizeof (ATLAS_TONE));
+
+		total = 0;
+
+		for (int y = level * cell_height; y < (level + 1) * cell_height; y++)
+		{
+			offset = (size_t)y * width;
+
+			for (size_t x = 0; x < width; x++)
+			{
+				// black is the background, not part of the glyph
+				if (!luminance[offset + x])
+					continue;
+
+				count[luminance[offset + x]] += 1;
+				sum[luminance[offset + x]] += saturation[offset + x];
+
+				total += 1;
+			}
+		}
+
+		// a level without lit pixels stays black
+		if (!total)
+			continue;
+
+		value = 0;
+		rank = count[0];
+
+		for (int c = 1; c < 256; c++)
+		{
+			// luminance of the lit pixel at the same rank as the coverage
+			while (value < 255 && ((uint64_t)rank * 255) < ((uint64_t)c * total))
+				rank += count[++value];
+
+			tone[level].saturation[c] = (uint8_t)(sum[value] / count[value]);
+			tone[level].luminance[c] = (uint8_t)value;
+		}
+	}
+}
+
+void ShadeGlyphCoverage (uint8_t *saturation, uint8_t *luminance, const uint8_t *coverage, int count, int columns, int cell_width, int cell_height, const ATLAS_TONE tone[ATLAS_LEVELS])
+{
+	const uint8_t *mask;
+	size_t width = (size_t)columns * cell_width;
+	size_t offset;
+	int band;
+
+	for (int i = 0; i < count; i++)
+	{
+		mask = coverage + ((size_t)i * cell_width * cell_height);
+		band = i / columns;
+
+		for (int level = 0; level < ATLAS_LEVELS; level++)
+		{
+			for (int y = 0; y < cell_height; y++)
+			{
+				offset = ((size_t)(((band * ATLAS_LEVELS) + level) * cell_height) + y) * width + ((size_t)(i - (band * columns)) * cell_width);
+
+				for (int x = 0; x < cell_width; x++)
+				{
+					saturation[offset + x] = tone[level].saturation[mask[(y * cell_width) + x]];
+					luminance[offset + x] = tone[level].luminance[mask[(y * cell_width) + x]];
+				}
+			}
+		}
+	}
+}
+
+uint64_t AtlasKeyUpdate (uint64_t key, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < size; i++)
+		key = (key ^ bytes[i]) * 0x100000001B3ull;
+
+	return key;
+}
+
+size_t AtlasImageSize (int columns, int rows, int cell_width, int cell_height)
+{
+	size_t count = (size_t)columns * cell_width * rows * cell_height;
+
+	// the planes are a multiple of 4 bytes, so the pixels stay aligned
+	return sizeof (ATLAS_IMAGE_HEADER) + (count * 2) + (count * sizeof (uint32_t));
+}
+
+void BakeAtlasHeader (PATLAS_IMAGE_HEADER header, const ATLAS_IMAGE *image)
+{
+	memset (header, 0, sizeof (ATLAS_IMAGE_HEADER));
+
+	header->magic = ATLAS_IMAGE_MAGIC;
+	header->columns = (uint32_t)image->columns;
+	header->rows = (uint32_t)image->rows;
+	header->cell_width = (uint32_t)image->cell_width;
+	header->cell_height = (uint32_t)image->cell_height;
+	header->hue = (uint32_t)(image->hue % HLS_MAX);
+	header->key[0] = (uint32_t)image->key;
+	header->key[1] = (uint32_t)(image->key >> 32);
+}
+
+void BakeAtlasImage (void *data, const ATLAS_IMAGE *image)
+{
+	uint8_t *planes = (uint8_t *)data + sizeof (ATLAS_IMAGE_HEADER);
+	size_t count = (size_t)image->columns * image->cell_width * image->rows * image->cell_height;
+
+	BakeAtlasHeader (data, image);
+
+	memcpy (planes, image->saturation, count);
+	memcpy (planes + count, image->luminance, count);
+
+	if (image->pixels)
+	{
+		memcpy (planes + (count * 2), image->pixels, count * sizeof (uint32_t));
+	}
+	else
+	{
+		RecolorPixels ((uint32_t *)(planes + (count * 2)), image->saturation, image->luminance, count, image->hue % HLS_MAX);
+	}
+}
+
+bool ReadAtlasImage (const void *data, size_t size, PATLAS_IMAGE image)
+{
+	const ATLAS_IMAGE_HEADER *header = data;
+	const uint8_t *planes = (const uint8_t *)data + sizeof (ATLAS_IMAGE_HEADER);
+	uint64_t count;
+
+	if (size < sizeof (ATLAS_IMAGE_HEADER) || header->magic != ATLAS_IMAGE_MAGIC || header->hue >= HLS_MAX)
+		return false;
+
+	// cells of the matrix, anything else would need scaling first
+	if (header->cell_width < CELL_SIZE_MIN || header->cell_width > CELL_SIZE_MAX || header->cell_height != header->cell_width * GLYPH_HEIGHT / GLYPH_WIDTH)
+		return false;
+
+	// bounds the size, so it cannot overflow
+	if (!header->columns || !header->rows || header->columns > GLYPHS_MAX || header->rows > GLYPHS_MAX * ATLAS_LEVELS)
+		return false;
+
+	count = (uint64_t)header->columns * header->cell_width * header->rows * header->cell_height;
+
+	if ((uint64_t)size < sizeof (ATLAS_IMAGE_HEADER) + (count * 2) + (count * sizeof (uint32_t)))
+		return false;
+
+	image->saturation = planes;
+	image->luminance = planes + count;
+	image->pixels = (const uint32_t *)(planes + (count * 2));
+
+	image->key = header->key[0] | ((uint64_t)header->key[1] << 32);
+
+	image->columns = (int)header->columns;
+	image->rows = (int)header->rows;
+	image->cell_width = (int)header->cell_width;
+	image->cell_height = (int)header->cell_height;
+	image->hue = (int)header->hue;
+
+	return true;
+}
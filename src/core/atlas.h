@@ -0,0 +1,106 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "render.h"
+
+// "ATL1", first word of a baked atlas
+#define ATLAS_IMAGE_MAGIC 0x314C5441
+
+// first value of an atlas key
+#define ATLAS_KEY_INIT 0xCBF29CE484222325ull
+
+//
+//	Header of a baked glyph atlas, either the one built with the
+//	screensaver or one of the cache files built from a font. It is
+//	followed by the saturation and luminance planes of the glyphs and by
+//	the same glyphs recolored to "hue", everything top-down and
+//	little-endian, so the atlas needs no decoding and no recoloring.
+//	The layout of the glyphs is the one of GLYPH_ATLAS.
+//
+typedef struct _ATLAS_IMAGE_HEADER
+{
+	uint32_t magic;
+	uint32_t columns;
+	uint32_t rows;
+	uint32_t cell_width;
+	uint32_t cell_height;
+	uint32_t hue;
+	uint32_t key[2]; // what the glyphs were made from, zero for the bitmap
+} ATLAS_IMAGE_HEADER, *PATLAS_IMAGE_HEADER;
+
+// baked atlas as found in memory, nothing is copied
+typedef struct _ATLAS_IMAGE
+{
+	const uint8_t *saturation;
+	const uint8_t *luminance;
+	const uint32_t *pixels;
+
+	uint64_t key;
+
+	int columns;
+	int rows;
+	int cell_width;
+	int cell_height;
+	int hue;
+} ATLAS_IMAGE, *PATLAS_IMAGE;
+
+// saturation and luminance of one intensity level, by glyph coverage
+typedef struct _ATLAS_TONE
+{
+	uint8_t saturation[256];
+	uint8_t luminance[256];
+} ATLAS_TONE, *PATLAS_TONE;
+
+// rows of glyphs of an atlas holding "count" glyphs in bands of "columns"
+static inline int AtlasGlyphRows (int count, int columns)
+{
+	return ((count + columns - 1) / columns) * ATLAS_LEVELS;
+}
+
+//
+//	Glyphs of an uncompressed 8-bit bitmap file, partial glyphs at the
+//	right or bottom edge are dropped. Returns false for anything else.
+//
+bool GlyphBitmapSize (const uint8_t *data, size_t size, int *columns, int *rows);
+
+// saturation and luminance of every pixel of the whole glyphs, top-down
+// planes of GlyphBitmapSize glyphs each
+void DecodeGlyphBitmap (const uint8_t *data, uint8_t *saturation, uint8_t *luminance);
+
+//
+//	Tones of every intensity level of the first band of glyph planes.
+//	Coverage is mapped to the lit pixels of the level in the order of
+//	their luminance, so glyphs shaded with them look like the source.
+//
+void MeasureAtlasTones (PATLAS_TONE tone, const uint8_t *saturation, const uint8_t *luminance, int columns, int cell_width, int cell_height);
+
+//
+//	Glyph planes from coverage masks, "count" masks of cell_width by
+//	cell_height one after another. Every glyph gets all ATLAS_LEVELS
+//	intensities, in bands of "columns" glyphs. Cells past "count" are
+//	left as they are.
+//
+void ShadeGlyphCoverage (uint8_t *saturation, uint8_t *luminance, const uint8_t *coverage, int count, int columns, int cell_width, int cell_height, const ATLAS_TONE tone[ATLAS_LEVELS]);
+
+// hashes "data" into the key of an atlas
+uint64_t AtlasKeyUpdate (uint64_t key, const void *data, size_t size);
+
+// bytes of a baked atlas
+size_t AtlasImageSize (int columns, int rows, int cell_width, int cell_height);
+
+// header of an atlas with the size, hue and key of "image", the planes
+// and the pixels follow it in this order
+void BakeAtlasHeader (PATLAS_IMAGE_HEADER header, const ATLAS_IMAGE *image);
+
+// writes an atlas of AtlasImageSize bytes from the planes and the size,
+// hue and key of "image", its pixels get recolored when they are null
+void BakeAtlasImage (void *data, const ATLAS_IMAGE *image);
+
+// points "image" into a baked atlas, false when it is damaged
+bool ReadAtlasImage (const void *data, size_t size, PATLAS_IMAGE image);
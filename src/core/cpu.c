@@ -0,0 +1,85 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "cpu.h"
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(CPU_X86)
+#include <cpuid.h>
+#endif
+
+#if defined(CPU_X86)
+
+static void CpuId (uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex ((int *)regs, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count (leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t CpuXgetbv (void)
+{
+#if defined(_MSC_VER)
+	return _xgetbv (0);
+#else
+	uint32_t eax;
+	uint32_t edx;
+
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static uint32_t CpuDetectFeatures (void)
+{
+	uint32_t regs[4];
+	uint32_t features = 0;
+	uint32_t max_leaf;
+
+	CpuId (0, 0, regs);
+
+	max_leaf = regs[0];
+
+	if (max_leaf < 1)
+		return 0;
+
+	CpuId (1, 0, regs);
+
+	if (regs[3] & (1 << 26))
+		features |= CPU_FEATURE_SSE2;
+
+	// avx2 also needs the os to save ymm registers (osxsave + xcr0)
+	if (max_leaf >= 7 && (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)))
+	{
+		if ((CpuXgetbv () & 0x06) == 0x06)
+		{
+			CpuId (7, 0, regs);
+
+			if (regs[1] & (1 << 5))
+				features |= CPU_FEATURE_AVX2;
+		}
+	}
+
+	return features;
+}
+
+#endif // CPU_X86
+
+uint32_t CpuGetFeatures (void)
+{
+#if defined(CPU_X86)
+	static volatile int32_t features = -1;
+
+	// racing threads compute the same value, so no locking needed
+	if (features == -1)
+		features = (int32_t)CpuDetectFeatures ();
+
+	return (uint32_t)features;
+#else
+	return 0;
+#endif
+}
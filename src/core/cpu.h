@@ -0,0 +1,65 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_X86
+#endif
+
+// gcc and clang only emit avx2 instructions inside functions marked for it,
+// msvc allows intrinsics everywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_TARGET_SSE2 __attribute__ ((target ("sse2")))
+#define CPU_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#else
+#define CPU_TARGET_SSE2
+#define CPU_TARGET_AVX2
+#endif
+
+#define CPU_FEATURE_SSE2 0x01
+#define CPU_FEATURE_AVX2 0x02
+
+uint32_t CpuGetFeatures (void);
+
+// index of the lowest set bit, the value must not be zero
+static inline int CpuLowestBit (uint32_t value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+
+	_BitScanForward (&index, value);
+
+	return (int)index;
+#else
+	return __builtin_ctz (value);
+#endif
+}
+
+static inline int CpuLowestBit64 (uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+	unsigned long index;
+
+	if (_BitScanForward (&index, (unsigned long)value))
+		return (int)index;
+
+	_BitScanForward (&index, (unsigned long)(value >> 32));
+
+	return (int)index + 32;
+#elif defined(_MSC_VER)
+	unsigned long index;
+
+	_BitScanForward64 (&index, value);
+
+	return (int)index;
+#else
+	return __builtin_ctzll (value);
+#endif
+}
@@ -0,0 +1,99 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "governor.h"
+
+// weight of the last frame in the average, as a shift
+#define GOVERNOR_SMOOTHING 3
+
+typedef struct _QUALITY_LEVEL
+{
+	int mutations;
+	bool is_blips;
+} QUALITY_LEVEL;
+
+static const QUALITY_LEVEL quality_level[QUALITY_MAX + 1] = {
+	{0, false},
+	{2, false},
+	{4, true},
+	{8, true},
+	{MUTATIONS_MAX, true},
+};
+
+static int ClampQuality (int level)
+{
+	return (level < QUALITY_MIN) ? QUALITY_MIN : (level > QUALITY_MAX) ? QUALITY_MAX : level;
+}
+
+void GovernorInit (PFRAME_GOVERNOR governor, int ceiling, int floor)
+{
+	governor->ceiling = ClampQuality (ceiling);
+	governor->floor = ClampQuality (floor);
+
+	if (governor->floor > governor->ceiling)
+		governor->floor = governor->ceiling;
+
+	governor->level = governor->ceiling;
+	governor->average = 0;
+	governor->over = 0;
+	governor->under = 0;
+}
+
+int GovernorAddFrame (PFRAME_GOVERNOR governor, int64_t cost, int64_t budget)
+{
+	if (!governor->average)
+	{
+		governor->average = cost;
+	}
+	else
+	{
+		governor->average += (cost - governor->average) >> GOVERNOR_SMOOTHING;
+	}
+
+	if (budget <= 0)
+		return governor->level;
+
+	if (governor->average > budget)
+	{
+		governor->over += 1;
+		governor->under = 0;
+	}
+	else if (governor->average < budget / 2)
+	{
+		governor->under += 1;
+		governor->over = 0;
+	}
+	else
+	{
+		governor->over = 0;
+		governor->under = 0;
+	}
+
+	if (governor->over >= GOVERNOR_DROP_FRAMES && governor->level > governor->floor)
+	{
+		governor->level -= 1;
+		governor->over = 0;
+
+		// the cost of the new level is measured from scratch
+		governor->average = 0;
+	}
+	else if (governor->under >= GOVERNOR_RAISE_FRAMES && governor->level < governor->ceiling)
+	{
+		governor->level += 1;
+		governor->under = 0;
+
+		governor->average = 0;
+	}
+
+	return governor->level;
+}
+
+void GovernorApply (const FRAME_GOVERNOR *governor, PMATRIX matrix)
+{
+	const QUALITY_LEVEL *level = &quality_level[ClampQuality (governor->level)];
+
+	matrix->mutations = level->mutations;
+
+	if (matrix->is_blips != level->is_blips)
+		SetMatrixBlips (matrix, level->is_blips);
+}
@@ -0,0 +1,54 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+// levels of optional work, the highest one does all of it
+#define QUALITY_MIN 0
+#define QUALITY_MAX 4
+#define QUALITY_DEFAULT QUALITY_MAX
+#define QUALITY_FLOOR_DEFAULT QUALITY_MIN
+
+// frames over budget before a level is dropped
+#define GOVERNOR_DROP_FRAMES 8
+
+// frames with headroom before a level is restored
+#define GOVERNOR_RAISE_FRAMES 120
+
+//
+//	Frame budget governor. A frame costing more than the time until the
+//	next one makes the simulation fall behind, so while the smoothed
+//	cost stays over budget the optional work is scaled back one level at
+//	a time, down to "floor". Once the cost is below half the budget for
+//	long enough, the work comes back, up to "ceiling". Levels drop
+//	quickly and come back slowly, so they do not flap around the budget.
+//
+typedef struct _FRAME_GOVERNOR
+{
+	int64_t average; // smoothed frame cost, in clock ticks
+
+	int level;
+	int floor;
+	int ceiling;
+
+	// consecutive frames over budget or with headroom
+	int over;
+	int under;
+} FRAME_GOVERNOR, *PFRAME_GOVERNOR;
+
+// starts at "ceiling", a floor at the ceiling disables the governor
+void GovernorInit (PFRAME_GOVERNOR governor, int ceiling, int floor);
+
+// cost and budget of the last frame, returns the level of the next one
+int GovernorAddFrame (PFRAME_GOVERNOR governor, int64_t cost, int64_t budget);
+
+//
+//	Optional work of the current level: glyph mutations are cut first,
+//	blips go at the lowest levels. Call between ticks, like any other
+//	setting of the matrix.
+//
+void GovernorApply (const FRAME_GOVERNOR *governor, PMATRIX matrix);
@@ -0,0 +1,887 @@
+// Matrix Screensaver
+// Copyright (c) J Brown 2003 (catch22.net)
+// Copyright (c) 2011-2021 Henry++
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "matrix.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#endif
+
+// columns scrolled together by the vector kernels
+#define SCROLL_LANES_MAX 16
+
+// marks the glyphs a vector kernel changed, never stored
+#define SCROLL_CHANGED 0x8000
+
+//
+//	Column automaton. How a glyph scrolls only depends on its intensity
+//	and on the state left behind by the glyph above it, which is either
+//	that glyph's intensity or "skip" right after an insertion or after
+//	darkening the brightest level:
+//
+//	skip    - keep the glyph, next is its intensity
+//	insert  - intensity == 0 && state > 0, brightest glyph, next is skip
+//	darken  - intensity > state, one level darker, next is that level or
+//	          skip when it was the brightest one
+//	keep    - everything else, next is the intensity
+//
+//	The preprocessor generates the tables from MAX_INTENSITY. For every
+//	intensity one 64-bit word holds a byte per state with the action and
+//	the next state, kept as its shift into the word, so the only work
+//	between two glyphs is a shift and a mask. Every action but keep
+//	makes the glyph dirty.
+//
+#define SCROLL_LEVELS 8 // intensities the tables cover
+#define SCROLL_STATES 8 // states of one word, a byte each
+#define SCROLL_STATE_SKIP (MAX_INTENSITY + 1)
+
+#if SCROLL_STATE_SKIP >= SCROLL_STATES || SCROLL_LEVELS != (GLYPH_INTENSITY_MASK >> GLYPH_INTENSITY_SHIFT) + 1
+#error MAX_INTENSITY does not fit the scroll tables
+#endif
+
+#define SCROLL_ACTION_KEEP 0
+#define SCROLL_ACTION_DARKEN 1
+#define SCROLL_ACTION_INSERT 2
+
+#define SCROLL_IS_INSERT(s, c) ((s) != SCROLL_STATE_SKIP && (c) == 0 && (s) > 0)
+#define SCROLL_IS_DARKEN(s, c) ((s) != SCROLL_STATE_SKIP && (c) > (s))
+
+#define SCROLL_ACTION(s, c) (SCROLL_IS_INSERT (s, c) ? SCROLL_ACTION_INSERT : SCROLL_IS_DARKEN (s, c) ? SCROLL_ACTION_DARKEN : SCROLL_ACTION_KEEP)
+#define SCROLL_NEXT(s, c) ((SCROLL_IS_INSERT (s, c) || (SCROLL_IS_DARKEN (s, c) && (c) == MAX_INTENSITY - 1)) ? SCROLL_STATE_SKIP : SCROLL_IS_DARKEN (s, c) ? (c) - 1 : (c))
+
+// macros do not expand inside themselves, so every table has its own
+#define SCROLL_BYTE(s, c) ((uint64_t)((SCROLL_NEXT (s, c) * 8) | SCROLL_ACTION (s, c)) << ((s) * 8))
+#define SCROLL_WORD(c) (SCROLL_BYTE (0, c) | SCROLL_BYTE (1, c) | SCROLL_BYTE (2, c) | SCROLL_BYTE (3, c) | SCROLL_BYTE (4, c) | SCROLL_BYTE (5, c) | SCROLL_BYTE (6, c) | SCROLL_BYTE (7, c)),
+#define SCROLL_WORDS_4(c) SCROLL_WORD (c + 0) SCROLL_WORD (c + 1) SCROLL_WORD (c + 2) SCROLL_WORD (c + 3)
+
+#define SCROLL_ENTRIES(c) {{0xFFFF, 0}, {GLYPH_INDEX_MASK, GLYPH_MAKE ((c) ? (c) - 1 : 0, 0)}, {0x0000, GLYPH_MAKE (MAX_INTENSITY - 1, 0)}, {0xFFFF, 0}},
+#define SCROLL_ENTRIES_4(c) SCROLL_ENTRIES (c + 0) SCROLL_ENTRIES (c + 1) SCROLL_ENTRIES (c + 2) SCROLL_ENTRIES (c + 3)
+
+// insertions are the only transitions keeping nothing, the random
+// index is or-ed in afterwards
+typedef struct _SCROLL_TRANSITION
+{
+	uint16_t keep;
+	uint16_t set;
+} SCROLL_TRANSITION, *PSCROLL_TRANSITION;
+
+// action and next state of every state, by intensity
+static const uint64_t scroll_automaton[SCROLL_LEVELS] = {
+	SCROLL_WORDS_4 (0) SCROLL_WORDS_4 (4)
+};
+
+// bits to keep and to set, by intensity and action
+static const SCROLL_TRANSITION scroll_table[SCROLL_LEVELS][4] = {
+	SCROLL_ENTRIES_4 (0) SCROLL_ENTRIES_4 (4)
+};
+
+static void *DefaultAllocate (void *context, size_t size)
+{
+	(void)context;
+
+	return calloc (1, size);
+}
+
+static void DefaultFree (void *context, void *ptr)
+{
+	(void)context;
+
+	free (ptr);
+}
+
+static uint32_t DefaultRandom (void *context)
+{
+	(void)context;
+
+	// rand () only guarantees 15 bits
+	return ((uint32_t)rand () << 15) ^ (uint32_t)rand ();
+}
+
+static inline GLYPH RandomGlyph (PMATRIX matrix, PMATRIX_COLUMN column, int intensity)
+{
+	return GLYPH_MAKE (intensity, RngRange (&column->rng, matrix->amount));
+}
+
+static inline void RedrawBlip (PMATRIX_COLUMN column)
+{
+	MatrixSetDirty (column, column->blip_pos + 0);
+	MatrixSetDirty (column, column->blip_pos + 1);
+	MatrixSetDirty (column, column->blip_pos + 8);
+	MatrixSetDirty (column, column->blip_pos + 9);
+}
+
+// moves the blip, which is only drawn over glyphs which may be lit
+static void MoveBlip (PMATRIX_COLUMN column, bool is_drawn)
+{
+	// mark current blip as redraw so it gets "erased"
+	if (is_drawn && column->blip_pos >= 0 && column->blip_pos < column->length)
+		RedrawBlip (column);
+
+	// advance down screen at double-speed
+	column->blip_pos += 2;
+
+	// if the blip gets to the end of a run, start it again (for a random
+	// length so that the blips never get synched together)
+	if (column->blip_pos >= column->blip_length)
+	{
+		column->blip_length = column->length + RngRange (&column->rng, 50);
+		column->blip_pos = 0;
+	}
+
+	// now redraw blip at new position
+	if (is_drawn && column->blip_pos >= 0 && column->blip_pos < column->length)
+		RedrawBlip (column);
+}
+
+//
+//	Run state and blip, updated after the glyphs have been scrolled.
+//	A scroll which changed nothing while blanks are being fed in means
+//	every glyph is dark, so the column stays as it is until the run
+//	length expires and can be skipped until then. Untracked steps leave
+//	the dirty bits alone, see PrewarmMatrixColumns.
+//
+static void ScrollColumnTail (PMATRIX matrix, PMATRIX_COLUMN column, bool is_changed, bool is_tracked)
+{
+	bool is_blank = !is_changed && column->state;
+
+	// change state from blanks <-> runs when the current run as expired
+	if (--column->run_length <= 0)
+	{
+		int density = DENSITY_MAX - matrix->density + DENSITY_MIN;
+
+		if (column->state ^= 1)
+		{
+			column->run_length = RngRange (&column->rng, 3 * density / 2) + DENSITY_MIN;
+		}
+		else
+		{
+			column->run_length = RngRange (&column->rng, DENSITY_MAX + 1 - density) + (DENSITY_MIN * 2);
+		}
+	}
+
+	MoveBlip (column, matrix->is_blips && is_tracked);
+
+	// the tick the run length expires on is a full one again
+	if (is_blank && column->state)
+		column->idle_ticks = column->run_length - 1;
+}
+
+//
+//	Rows a scroll has to visit. Dark glyphs above the lit ones keep the
+//	automaton in its first state, so they are skipped unless a run is
+//	being fed in, and nothing changes below the row after the lowest lit
+//	glyph. The top moves down as glyphs go dark, which is only checked
+//	here, so the range may be a little wider than needed.
+//
+static void ScrollRange (PMATRIX_COLUMN column, int *start, int *end)
+{
+	int bottom = (column->lit_bottom < column->length) ? column->lit_bottom : column->length;
+
+	while (column->lit_top < bottom && !GlyphIntensity (column->glyph[column->lit_top]))
+		column->lit_top += 1;
+
+	if (column->lit_top >= bottom)
+		column->lit_top = bottom = 0;
+
+	// a run starts with an insertion at the top
+	*start = column->state ? column->lit_top : 0;
+
+	// and grows by the insertion below its lowest glyph
+	*end = (bottom < column->length) ? (bottom + 1) : column->length;
+
+	column->lit_top = *start;
+	column->lit_bottom = *end;
+}
+
+//
+//	Steps a column which has nothing to scroll, returns false when it
+//	has to be scrolled. Waiting columns only count down, idle ones only
+//	move their run length and blip on, so the random streams stay the
+//	same as if they had been scrolled.
+//
+static bool SkipMatrixColumn (PMATRIX_COLUMN column)
+{
+	// wait until we are allowed to scroll
+	if (!column->is_started)
+	{
+		if (--column->countdown <= 0)
+			column->is_started = true;
+
+		return true;
+	}
+
+	if (!column->idle_ticks)
+		return false;
+
+	column->idle_ticks -= 1;
+	column->run_length -= 1;
+
+	// nothing is lit, so the blip does not show
+	MoveBlip (column, false);
+
+	return true;
+}
+
+//
+//	Reference implementation, the vector kernels below must give
+//	exactly the same result.
+//
+static void ScrollColumn (PMATRIX matrix, PMATRIX_COLUMN column, bool is_tracked)
+{
+	const SCROLL_TRANSITION *transition;
+	uint64_t dirty = 0;
+	uint64_t changed = 0;
+	GLYPH glyph;
+	uint32_t intensity;
+	uint32_t state;
+	uint32_t shift;
+	int start;
+	int end;
+
+	if (SkipMatrixColumn (column))
+		return;
+
+	ScrollRange (column, &start, &end);
+
+	// "seed" the glyph-run
+	shift = column->state ? 0 : (MAX_INTENSITY * 8);
+
+	//
+	// loop over the lit part of the column, looking for changes
+	// in intensity/darkness. This change signifies the start/end
+	// of a run of glyphs. The bottom-most part of a run gets a new
+	// glyph inserted below it, so the run is "falling" down the screen,
+	// the top-most part is darkened until it eventually turns black.
+	//
+	for (int y = start; y < end; y++)
+	{
+		glyph = column->glyph[y];
+		intensity = GLYPH_INTENSITY (glyph);
+
+		state = (uint32_t)(scroll_automaton[intensity] >> shift);
+		transition = &scroll_table[intensity][state & 3];
+
+		glyph = (GLYPH)((glyph & transition->keep) | transition->set);
+
+		// once per run and tick, so it is well predicted
+		if (!transition->keep)
+			glyph |= (GLYPH)RngRange (&column->rng, matrix->amount);
+
+		column->glyph[y] = glyph;
+
+		dirty |= (uint64_t)((state & 3) != SCROLL_ACTION_KEEP) << (y % DIRTY_WORD_BITS);
+
+		if (y % DIRTY_WORD_BITS == DIRTY_WORD_BITS - 1)
+		{
+			if (is_tracked)
+				column->dirty[y / DIRTY_WORD_BITS] |= dirty;
+
+			changed |= dirty;
+			dirty = 0;
+		}
+
+		shift = state & ((SCROLL_STATES - 1) * 8);
+	}
+
+	// rest of the last word
+	if (dirty && is_tracked)
+		column->dirty[(end - 1) / DIRTY_WORD_BITS] |= dirty;
+
+	ScrollColumnTail (matrix, column, (changed | dirty) != 0, is_tracked);
+}
+
+void ScrollMatrixColumn (PMATRIX matrix, PMATRIX_COLUMN column)
+{
+	ScrollColumn (matrix, column, true);
+}
+
+//
+//	The vector kernels scroll a block of neighbouring columns at once.
+//	Every 16 glyph tile of the block is transposed into rows, so a
+//	single register holds the same row of all the columns, and the
+//	branches of the scalar loop turn into per-lane compare and blend:
+//
+//	skip    - the previous glyph was inserted or fully darkened
+//	insert  - !skip && intensity == 0 && last > 0
+//	darken  - !skip && intensity > last
+//	last    - darken ? intensity - 1 : intensity
+//
+//	These are the transitions of the column automaton as lane masks.
+//	Changed glyphs carry SCROLL_CHANGED until the tile is transposed
+//	back, which turns it into the dirty bits of every lane at once.
+//	Inserted glyphs only get their intensity from the kernel, the random
+//	index is picked afterwards in column order, so the per-column random
+//	streams see exactly the same sequence as the reference.
+//
+typedef struct _SCROLL_BLOCK
+{
+	PGLYPH glyph[SCROLL_LANES_MAX]; // null for lanes which do not scroll
+
+	// per-lane kernel state, intensity bits in place
+	uint16_t active[SCROLL_LANES_MAX];
+	uint16_t last[SCROLL_LANES_MAX];
+	uint16_t skip[SCROLL_LANES_MAX];
+
+	// lanes which got a glyph inserted, one mask per tile row
+	uint32_t insert[SCROLL_LANES_MAX];
+
+	// rows which changed, one mask per lane
+	uint32_t changed[SCROLL_LANES_MAX];
+
+	GLYPH dummy[SCROLL_LANES_MAX];
+} SCROLL_BLOCK, *PSCROLL_BLOCK;
+
+// scroll "rows" rows of a tile starting at "y", returns every lane that got an insertion
+typedef uint32_t (*SCROLL_TILE) (PSCROLL_BLOCK block, int y, int rows);
+
+#if defined(CPU_X86)
+
+CPU_TARGET_SSE2 static inline void Transpose8x8Sse2 (__m128i r[8])
+{
+	__m128i a[8];
+	__m128i b[8];
+
+	for (int i = 0; i < 8; i += 2)
+	{
+		a[i + 0] = _mm_unpacklo_epi16 (r[i], r[i + 1]);
+		a[i + 1] = _mm_unpackhi_epi16 (r[i], r[i + 1]);
+	}
+
+	for (int i = 0; i < 8; i += 4)
+	{
+		b[i + 0] = _mm_unpacklo_epi32 (a[i + 0], a[i + 2]);
+		b[i + 1] = _mm_unpackhi_epi32 (a[i + 0], a[i + 2]);
+		b[i + 2] = _mm_unpacklo_epi32 (a[i + 1], a[i + 3]);
+		b[i + 3] = _mm_unpackhi_epi32 (a[i + 1], a[i + 3]);
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		r[i * 2 + 0] = _mm_unpacklo_epi64 (b[i], b[i + 4]);
+		r[i * 2 + 1] = _mm_unpackhi_epi64 (b[i], b[i + 4]);
+	}
+}
+
+CPU_TARGET_SSE2 static uint32_t ScrollTileSse2 (PSCROLL_BLOCK block, int y, int rows)
+{
+	const __m128i intensity_mask = _mm_set1_epi16 (GLYPH_INTENSITY_MASK);
+	const __m128i index_mask = _mm_set1_epi16 (GLYPH_INDEX_MASK);
+	const __m128i changed = _mm_set1_epi16 ((short)SCROLL_CHANGED);
+	const __m128i unchanged = _mm_set1_epi16 ((short)~SCROLL_CHANGED);
+	const __m128i inserted = _mm_set1_epi16 ((short)(SCROLL_CHANGED | GLYPH_MAKE (MAX_INTENSITY - 1, 0)));
+	const __m128i brightest = _mm_set1_epi16 (GLYPH_MAKE (MAX_INTENSITY - 1, 0));
+	const __m128i step = _mm_set1_epi16 (1 << GLYPH_INTENSITY_SHIFT);
+	const __m128i zero = _mm_setzero_si128 ();
+	__m128i active = _mm_loadu_si128 ((const __m128i *)block->active);
+	__m128i last = _mm_loadu_si128 ((const __m128i *)block->last);
+	__m128i skip = _mm_loadu_si128 ((const __m128i *)block->skip);
+	__m128i r[8];
+	__m128i cur;
+	__m128i scroll;
+	__m128i insert;
+	__m128i darken;
+	__m128i darkened;
+	uint32_t any = 0;
+	uint32_t mask;
+
+	for (int i = 0; i < 8; i++)
+		r[i] = _mm_loadu_si128 ((const __m128i *)(block->glyph[i] ? block->glyph[i] + y : block->dummy));
+
+	Transpose8x8Sse2 (r);
+
+	for (int i = 0; i < rows; i++)
+	{
+		cur = _mm_and_si128 (r[i], intensity_mask);
+
+		scroll = _mm_andnot_si128 (skip, active);
+
+		insert = _mm_and_si128 (scroll, _mm_and_si128 (_mm_cmpeq_epi16 (cur, zero), _mm_cmpgt_epi16 (last, zero)));
+		darken = _mm_and_si128 (scroll, _mm_cmpgt_epi16 (cur, last));
+
+		darkened = _mm_or_si128 (_mm_or_si128 (changed, _mm_sub_epi16 (cur, step)), _mm_and_si128 (r[i], index_mask));
+
+		r[i] = _mm_or_si128 (_mm_andnot_si128 (darken, r[i]), _mm_and_si128 (darken, darkened));
+		r[i] = _mm_or_si128 (_mm_andnot_si128 (insert, r[i]), _mm_and_si128 (insert, inserted));
+
+		skip = _mm_or_si128 (insert, _mm_and_si128 (darken, _mm_cmpeq_epi16 (cur, brightest)));
+		last = _mm_sub_epi16 (cur, _mm_and_si128 (darken, step));
+
+		mask = (uint32_t)_mm_movemask_epi8 (_mm_packs_epi16 (insert, zero));
+
+		block->insert[i] = mask;
+		any |= mask;
+	}
+
+	Transpose8x8Sse2 (r);
+
+	for (int i = 0; i < 8; i++)
+	{
+		// the marker is the sign bit, which survives the packing
+		block->changed[i] = (uint32_t)_mm_movemask_epi8 (_mm_packs_epi16 (r[i], zero)) & 0xFF;
+
+		if (block->glyph[i])
+			_mm_storeu_si128 ((__m128i *)(block->glyph[i] + y), _mm_and_si128 (r[i], unchanged));
+	}
+
+	_mm_storeu_si128 ((__m128i *)block->last, last);
+	_mm_storeu_si128 ((__m128i *)block->skip, skip);
+
+	return any;
+}
+
+//
+//	Each 128-bit half of the rows is transposed like the sse2 version,
+//	the halves are then swapped between the first and the last 8 rows.
+//
+CPU_TARGET_AVX2 static inline void Transpose16x16Avx2 (__m256i r[16])
+{
+	__m256i a[16];
+	__m256i b[16];
+	__m256i c[16];
+
+	for (int i = 0; i < 16; i += 2)
+	{
+		a[i + 0] = _mm256_unpacklo_epi16 (r[i], r[i + 1]);
+		a[i + 1] = _mm256_unpackhi_epi16 (r[i], r[i + 1]);
+	}
+
+	for (int i = 0; i < 16; i += 4)
+	{
+		b[i + 0] = _mm256_unpacklo_epi32 (a[i + 0], a[i + 2]);
+		b[i + 1] = _mm256_unpackhi_epi32 (a[i + 0], a[i + 2]);
+		b[i + 2] = _mm256_unpacklo_epi32 (a[i + 1], a[i + 3]);
+		b[i + 3] = _mm256_unpackhi_epi32 (a[i + 1], a[i + 3]);
+	}
+
+	for (int h = 0; h < 16; h += 8)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			c[h + i * 2 + 0] = _mm256_unpacklo_epi64 (b[h + i], b[h + i + 4]);
+			c[h + i * 2 + 1] = _mm256_unpackhi_epi64 (b[h + i], b[h + i + 4]);
+		}
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		r[i + 0] = _mm256_permute2x128_si256 (c[i], c[i + 8], 0x20);
+		r[i + 8] = _mm256_permute2x128_si256 (c[i], c[i + 8], 0x31);
+	}
+}
+
+CPU_TARGET_AVX2 static uint32_t ScrollTileAvx2 (PSCROLL_BLOCK block, int y, int rows)
+{
+	const __m256i intensity_mask = _mm256_set1_epi16 (GLYPH_INTENSITY_MASK);
+	const __m256i index_mask = _mm256_set1_epi16 (GLYPH_INDEX_MASK);
+	const __m256i changed = _mm256_set1_epi16 ((short)SCROLL_CHANGED);
+	const __m256i unchanged = _mm256_set1_epi16 ((short)~SCROLL_CHANGED);
+	const __m256i inserted = _mm256_set1_epi16 ((short)(SCROLL_CHANGED | GLYPH_MAKE (MAX_INTENSITY - 1, 0)));
+	const __m256i brightest = _mm256_set1_epi16 (GLYPH_MAKE (MAX_INTENSITY - 1, 0));
+	const __m256i step = _mm256_set1_epi16 (1 << GLYPH_INTENSITY_SHIFT);
+	const __m256i zero = _mm256_setzero_si256 ();
+	__m256i active = _mm256_loadu_si256 ((const __m256i *)block->active);
+	__m256i last = _mm256_loadu_si256 ((const __m256i *)block->last);
+	__m256i skip = _mm256_loadu_si256 ((const __m256i *)block->skip);
+	__m256i r[16];
+	__m256i cur;
+	__m256i scroll;
+	__m256i insert;
+	__m256i darken;
+	__m256i darkened;
+	uint32_t any = 0;
+	uint32_t mask;
+
+	for (int i = 0; i < 16; i++)
+		r[i] = _mm256_loadu_si256 ((const __m256i *)(block->glyph[i] ? block->glyph[i] + y : block->dummy));
+
+	Transpose16x16Avx2 (r);
+
+	for (int i = 0; i < rows; i++)
+	{
+		cur = _mm256_and_si256 (r[i], intensity_mask);
+
+		scroll = _mm256_andnot_si256 (skip, active);
+
+		insert = _mm256_and_si256 (scroll, _mm256_and_si256 (_mm256_cmpeq_epi16 (cur, zero), _mm256_cmpgt_epi16 (last, zero)));
+		darken = _mm256_and_si256 (scroll, _mm256_cmpgt_epi16 (cur, last));
+
+		darkened = _mm256_or_si256 (_mm256_or_si256 (changed, _mm256_sub_epi16 (cur, step)), _mm256_and_si256 (r[i], index_mask));
+
+		r[i] = _mm256_blendv_epi8 (r[i], darkened, darken);
+		r[i] = _mm256_blendv_epi8 (r[i], inserted, insert);
+
+		skip = _mm256_or_si256 (insert, _mm256_and_si256 (darken, _mm256_cmpeq_epi16 (cur, brightest)));
+		last = _mm256_sub_epi16 (cur, _mm256_and_si256 (darken, step));
+
+		// packing works per 128-bit half, lanes 8-15 end up in bits 16-23
+		mask = (uint32_t)_mm256_movemask_epi8 (_mm256_packs_epi16 (insert, zero));
+		mask = (mask & 0xFF) | ((mask >> 8) & 0xFF00);
+
+		block->insert[i] = mask;
+		any |= mask;
+	}
+
+	Transpose16x16Avx2 (r);
+
+	for (int i = 0; i < 16; i++)
+	{
+		// the marker is the sign bit, which survives the packing
+		mask = (uint32_t)_mm256_movemask_epi8 (_mm256_packs_epi16 (r[i], zero));
+
+		block->changed[i] = (mask & 0xFF) | ((mask >> 8) & 0xFF00);
+
+		if (block->glyph[i])
+			_mm256_storeu_si256 ((__m256i *)(block->glyph[i] + y), _mm256_and_si256 (r[i], unchanged));
+	}
+
+	_mm256_storeu_si256 ((__m256i *)block->last, last);
+	_mm256_storeu_si256 ((__m256i *)block->skip, skip);
+
+	return any;
+}
+
+#endif // CPU_X86
+
+//
+//	Tiles are square, "lanes" columns by "lanes" rows. The columns of a
+//	block need not be neighbours, only columns which have something to
+//	scroll are gathered into it, all of the same length.
+//
+static void ScrollBlock (PMATRIX matrix, PMATRIX_COLUMN *column, int count, int lanes, SCROLL_TILE scroll_tile, bool is_tracked)
+{
+	SCROLL_BLOCK block = {0};
+	uint32_t inserted[SCROLL_LANES_MAX] = {0};
+	uint32_t changed[SCROLL_LANES_MAX] = {0};
+	uint32_t mask;
+	uint32_t any;
+	int first = column[0]->length;
+	int last = 0;
+	int start;
+	int end;
+	int rows;
+	int lane;
+
+	for (lane = 0; lane < count; lane++)
+	{
+		ScrollRange (column[lane], &start, &end);
+
+		// lanes are dark outside of their own range, which leaves them as they are
+		if (start < first)
+			first = start;
+
+		if (end > last)
+			last = end;
+
+		block.glyph[lane] = column[lane]->glyph;
+		block.active[lane] = 0xFFFF;
+
+		// "seed" the glyph-run
+		block.last[lane] = column[lane]->state ? 0 : GLYPH_MAKE (MAX_INTENSITY, 0);
+	}
+
+	// columns are padded, so tiles may read and write past the length
+	for (int y = first - (first % lanes); y < last; y += lanes)
+	{
+		rows = (last - y < lanes) ? (last - y) : lanes;
+
+		any = scroll_tile (&block, y, rows);
+
+		// tiles never straddle a dirty word, both are powers of two
+		for (lane = 0; lane < count; lane++)
+		{
+			if (block.changed[lane] && is_tracked)
+				column[lane]->dirty[y / DIRTY_WORD_BITS] |= (uint64_t)block.changed[lane] << (y % DIRTY_WORD_BITS);
+
+			changed[lane] |= block.changed[lane];
+		}
+
+		if (!any)
+			continue;
+
+		// regroup the insertions by column, they are rare
+		for (int i = 0; i < rows; i++)
+		{
+			for (mask = block.insert[i]; mask; mask &= mask - 1)
+				inserted[CpuLowestBit (mask)] |= 1u << i;
+		}
+
+		for (lane = 0; lane < count; lane++)
+		{
+			for (mask = inserted[lane]; mask; mask &= mask - 1)
+				column[lane]->glyph[y + CpuLowestBit (mask)] = RandomGlyph (matrix, column[lane], MAX_INTENSITY - 1);
+
+			inserted[lane] = 0;
+		}
+	}
+
+	for (lane = 0; lane < count; lane++)
+		ScrollColumnTail (matrix, column[lane], changed[lane] != 0, is_tracked);
+}
+
+static int GetScrollTile (SCROLL_TILE *scroll_tile)
+{
+#if defined(CPU_X86)
+	uint32_t features = CpuGetFeatures ();
+
+	if (features & CPU_FEATURE_AVX2)
+	{
+		*scroll_tile = &ScrollTileAvx2;
+		return 16;
+	}
+
+	if (features & CPU_FEATURE_SSE2)
+	{
+		*scroll_tile = &ScrollTileSse2;
+		return 8;
+	}
+#endif
+
+	*scroll_tile = NULL;
+
+	return 1;
+}
+
+static void ScrollColumns (PMATRIX matrix, int first, int count, bool is_tracked)
+{
+	PMATRIX_COLUMN awake[SCROLL_LANES_MAX];
+	PMATRIX_COLUMN column;
+	SCROLL_TILE scroll_tile;
+	int lanes = GetScrollTile (&scroll_tile);
+	int awake_count = 0;
+
+	for (int x = first; x < first + count; x++)
+	{
+		column = &matrix->column[x];
+
+		// waiting and idle columns cost no more than this
+		if (SkipMatrixColumn (column))
+			continue;
+
+		// the lanes of a block share their length
+		if (!scroll_tile || (awake_count && column->length != awake[0]->length))
+		{
+			ScrollColumn (matrix, column, is_tracked);
+			continue;
+		}
+
+		awake[awake_count++] = column;
+
+		if (awake_count == lanes)
+		{
+			ScrollBlock (matrix, awake, awake_count, lanes, scroll_tile, is_tracked);
+			awake_count = 0;
+		}
+	}
+
+	// a single column is not worth a tile
+	if (awake_count == 1)
+	{
+		ScrollColumn (matrix, awake[0], is_tracked);
+	}
+	else if (awake_count)
+	{
+		ScrollBlock (matrix, awake, awake_count, lanes, scroll_tile, is_tracked);
+	}
+}
+
+void ScrollMatrixColumns (PMATRIX matrix, int first, int count)
+{
+	ScrollColumns (matrix, first, count, true);
+}
+
+void SetMatrixBlips (PMATRIX matrix, bool is_enabled)
+{
+	PMATRIX_COLUMN column;
+
+	if (!is_enabled)
+	{
+		for (int x = 0; x < matrix->numcols; x++)
+		{
+			column = &matrix->column[x];
+
+			if (column->blip_pos >= 0 && column->blip_pos < column->length)
+				RedrawBlip (column);
+		}
+	}
+
+	matrix->is_blips = is_enabled;
+}
+
+//
+// randomly change a small collection glyphs in a column
+//
+static void RandomColumn (PMATRIX matrix, PMATRIX_COLUMN column, bool is_tracked)
+{
+	int end = (column->lit_bottom < column->length) ? column->lit_bottom : column->length;
+
+	// nothing is lit in waiting and idle columns
+	if (!column->is_started || column->idle_ticks)
+		return;
+
+	for (int i = 0, y = column->lit_top; i < matrix->mutations; i++)
+	{
+		// find a run
+		while (y < end && GlyphIntensity (column->glyph[y]) < (MAX_INTENSITY - 1))
+			y += 1;
+
+		if (y >= end)
+			break;
+
+		column->glyph[y] = GLYPH_MAKE (GlyphIntensity (column->glyph[y]), RngRange (&column->rng, matrix->amount));
+
+		if (is_tracked)
+			MatrixSetDirty (column, y);
+
+		y += RngRange (&column->rng, 10);
+	}
+}
+
+void RandomMatrixColumn (PMATRIX matrix, PMATRIX_COLUMN column)
+{
+	RandomColumn (matrix, column, true);
+}
+
+void UpdateMatrixColumn (PMATRIX matrix, PMATRIX_COLUMN column)
+{
+	RandomMatrixColumn (matrix, column);
+	ScrollMatrixColumn (matrix, column);
+}
+
+void UpdateMatrixColumns (PMATRIX matrix, int first, int count)
+{
+	// every column draws from its own stream, so the order does not matter
+	for (int x = first; x < first + count; x++)
+		RandomMatrixColumn (matrix, &matrix->column[x]);
+
+	ScrollMatrixColumns (matrix, first, count);
+}
+
+void PrewarmMatrixColumns (PMATRIX matrix, int first, int count, int ticks)
+{
+	PMATRIX_COLUMN column;
+	int words = (int)MatrixDirtyStride (matrix->stride);
+
+	// every tick of a column range in one go, it stays in the cache
+	for (int i = 0; i < ticks; i++)
+	{
+		for (int x = first; x < first + count; x++)
+			RandomColumn (matrix, &matrix->column[x], false);
+
+		ScrollColumns (matrix, first, count, false);
+	}
+
+	// nothing in view was drawn since
+	for (int x = first; x < first + count; x++)
+	{
+		column = &matrix->column[x];
+
+		for (int w = 0; w < words; w++)
+			column->dirty[w] |= MatrixDirtyRowMask (column->length, w);
+	}
+}
+
+PMATRIX CreateMatrix (int width, int height, int cell_size, uint64_t seed, const MATRIX_HOOKS *hooks)
+{
+	MATRIX_HOOKS matrix_hooks = {0};
+	PMATRIX matrix;
+	uintptr_t grid;
+	size_t header_size;
+	size_t stride;
+	size_t dirty_stride;
+	int cell_width = MatrixCellSize (cell_size);
+	int cell_height = cell_width * GLYPH_HEIGHT / GLYPH_WIDTH;
+	int numcols = width / cell_width + 1;
+	int numrows = height / cell_height + 1;
+
+	if (hooks)
+		matrix_hooks = *hooks;
+
+	if (!matrix_hooks.allocate || !matrix_hooks.free)
+	{
+		matrix_hooks.allocate = &DefaultAllocate;
+		matrix_hooks.free = &DefaultFree;
+	}
+
+	if (!matrix_hooks.random)
+		matrix_hooks.random = &DefaultRandom;
+
+	// columns start on a cache line and keep room for the blip overrun
+	stride = MatrixStride (numrows);
+
+	dirty_stride = MatrixDirtyStride (stride);
+
+	// header, columns, glyph grid and dirty bitsets share a single allocation
+	header_size = sizeof (MATRIX) + (sizeof (MATRIX_COLUMN) * numcols);
+
+	matrix = matrix_hooks.allocate (matrix_hooks.context, header_size + GLYPH_ARENA_ALIGN + (stride * numcols * sizeof (GLYPH)) + (dirty_stride * numcols * sizeof (uint64_t)));
+
+	if (!matrix)
+		return NULL;
+
+	grid = ((uintptr_t)matrix + header_size + GLYPH_ARENA_ALIGN - 1) & ~(uintptr_t)(GLYPH_ARENA_ALIGN - 1);
+
+	matrix->grid = (PGLYPH)grid;
+	matrix->dirty = (uint64_t *)(grid + (stride * numcols * sizeof (GLYPH)));
+	matrix->stride = stride;
+	matrix->capacity = numcols;
+
+	matrix->hooks = matrix_hooks;
+
+	if (!seed)
+		seed = ((uint64_t)matrix_hooks.random (matrix_hooks.context) << 32) | matrix_hooks.random (matrix_hooks.context);
+
+	matrix->seed = seed;
+
+	matrix->amount = AMOUNT_DEFAULT;
+	matrix->density = DENSITY_DEFAULT;
+	matrix->mutations = MUTATIONS_MAX;
+	matrix->is_blips = true;
+
+	matrix->numcols = numcols;
+	matrix->numrows = numrows;
+	matrix->width = width;
+	matrix->height = height;
+	matrix->cell_width = cell_width;
+	matrix->cell_height = cell_height;
+
+	for (int x = 0; x < numcols; x++)
+		InitMatrixColumn (matrix, x);
+
+	return matrix;
+}
+
+void InitMatrixColumn (PMATRIX matrix, int x)
+{
+	PMATRIX_COLUMN column = &matrix->column[x];
+
+	memset (column, 0, sizeof (MATRIX_COLUMN));
+
+	// one stream per column, so columns can be updated in any order
+	RngSeed (&column->rng, matrix->seed, x);
+
+	column->length = matrix->numrows;
+	column->countdown = RngRange (&column->rng, COUNTDOWN_MAX);
+	column->state = RngRange (&column->rng, 2);
+	column->run_length = RngRange (&column->rng, 20) + 3;
+
+	column->glyph = matrix->grid + (matrix->stride * x);
+	column->dirty = matrix->dirty + (MatrixDirtyStride (matrix->stride) * x);
+
+	memset (column->glyph, 0, matrix->stride * sizeof (GLYPH));
+	memset (column->dirty, 0, MatrixDirtyStride (matrix->stride) * sizeof (uint64_t));
+}
+
+void DestroyMatrix (PMATRIX matrix)
+{
+	MATRIX_HOOKS hooks = matrix->hooks;
+
+	if (matrix->framebuffer && !matrix->is_framebuffer_inline)
+		hooks.free (hooks.context, matrix->framebuffer);
+
+	hooks.free (hooks.context, matrix);
+}
@@ -0,0 +1,280 @@
+// Matrix Screensaver
+// Copyright (c) J Brown 2003 (catch22.net)
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+//
+//	changed (1 bit) | intensity (3 bits) | index (12 bits)
+//
+//	The top bit is only ever set inside the scroll kernels, stored
+//	glyphs leave it clear.
+//
+#define GLYPH_INDEX_BITS 12
+#define GLYPH_INDEX_MASK ((1 << GLYPH_INDEX_BITS) - 1)
+
+#define GLYPH_INTENSITY_SHIFT GLYPH_INDEX_BITS
+#define GLYPH_INTENSITY_MASK (0x7 << GLYPH_INTENSITY_SHIFT)
+
+#define GLYPH_MAKE(intensity, index) ((GLYPH)(((intensity) << GLYPH_INTENSITY_SHIFT) | (index)))
+#define GLYPH_INTENSITY(glyph) (((glyph) & GLYPH_INTENSITY_MASK) >> GLYPH_INTENSITY_SHIFT)
+#define GLYPH_INDEX(glyph) ((glyph) & GLYPH_INDEX_MASK)
+
+// indices a glyph can hold, the amount is further limited to the
+// glyphs of the atlas in use
+#define GLYPHS_MAX (1 << GLYPH_INDEX_BITS)
+
+#define AMOUNT_MIN 1
+#define AMOUNT_MAX GLYPHS_MAX
+#define AMOUNT_DEFAULT 26
+
+#define DENSITY_MIN 5
+#define DENSITY_MAX 50
+#define DENSITY_DEFAULT 30
+
+#define SPEED_MIN 1
+#define SPEED_MAX 10
+#define SPEED_DEFAULT 6
+
+// glyphs changed per column and tick at most
+#define MUTATIONS_MAX 15
+
+// ticks a new column waits at most before its first run
+#define COUNTDOWN_MAX 100
+
+// constants inferred from matrix.bmp
+#define MAX_INTENSITY 5 // number of intensity levels
+#define GLYPH_WIDTH 14 // width of each glyph (pixels)
+#define GLYPH_HEIGHT 14 // height of each glyph (pixels)
+
+#if MAX_INTENSITY > (GLYPH_INTENSITY_MASK >> GLYPH_INTENSITY_SHIFT)
+#error MAX_INTENSITY does not fit the glyph
+#endif
+
+// cells on screen, glyphs get scaled from GLYPH_WIDTH to this (pixels)
+#define CELL_SIZE_MIN 8
+#define CELL_SIZE_MAX 56
+#define CELL_SIZE_DEFAULT GLYPH_WIDTH
+
+// padding after every column, blips are drawn up to 9 glyphs below their
+// position and the scroll kernels work on whole 16 glyph tiles
+#define GLYPH_PAD 16
+
+// column strides are rounded up to this many bytes
+#define GLYPH_ARENA_ALIGN 64
+
+// rows of a column in one word of its dirty bitset
+#define DIRTY_WORD_BITS 64
+
+typedef uint16_t GLYPH;
+typedef uint16_t *PGLYPH;
+
+//
+//	Allocation and random number hooks, so the core does not depend on
+//	any platform library. Any member left zero falls back to the c
+//	runtime. Allocations must return zeroed memory, the random hook is
+//	only used to pick a seed when none was given.
+//
+typedef struct _MATRIX_HOOKS
+{
+	void *(*allocate) (void *context, size_t size);
+	void (*free) (void *context, void *ptr);
+	uint32_t (*random) (void *context);
+
+	void *context;
+} MATRIX_HOOKS, *PMATRIX_HOOKS;
+
+//
+//	The "matrix" is basically an array of these
+//  column structures, positioned side-by-side
+//
+typedef struct _MATRIX_COLUMN
+{
+	PGLYPH glyph;
+
+	// one bit per glyph which changed since the last frame was built,
+	// the padding rows have bits as well
+	uint64_t *dirty;
+
+	RNG_STREAM rng;
+
+	int state;
+	int countdown;
+
+	int blip_pos;
+	int blip_length;
+
+	int length;
+	int run_length;
+
+	// rows outside [lit_top, lit_bottom) are dark, so they stay as they
+	// are while blanks are being fed in
+	int lit_top;
+	int lit_bottom;
+
+	// ticks the column is known to stay blank, nothing gets scrolled
+	// or drawn until its next run starts
+	int idle_ticks;
+
+	// frames the pixels of the column keep fading, see phosphor.h
+	int afterglow;
+
+	bool is_started;
+} MATRIX_COLUMN, *PMATRIX_COLUMN;
+
+typedef struct _MATRIX
+{
+	MATRIX_HOOKS hooks;
+
+	// back-buffer, see render.h
+	struct _FRAMEBUFFER *framebuffer;
+
+	// user settings, may be changed between ticks
+	int amount;
+	int density;
+
+	// optional work, see governor.h
+	int mutations;
+	bool is_blips;
+
+	uint64_t seed;
+
+	int width;
+	int height;
+	int numcols;
+	int numrows;
+
+	// size of a glyph on screen, in pixels
+	int cell_width;
+	int cell_height;
+
+	// every column lives in one arena, "stride" glyphs apart, the dirty
+	// bitsets follow the glyphs of all the columns
+	PGLYPH grid;
+	uint64_t *dirty;
+	size_t stride;
+
+	// columns the arena has room for, see ResizeMatrix
+	int capacity;
+
+	// the framebuffer shares the allocation of the matrix
+	bool is_framebuffer_inline;
+
+	MATRIX_COLUMN column[1];
+} MATRIX, *PMATRIX;
+
+static inline GLYPH GlyphIntensity (GLYPH glyph)
+{
+	return GLYPH_INTENSITY (glyph);
+}
+
+static inline int GlyphIndex (GLYPH glyph)
+{
+	return (int)GLYPH_INDEX (glyph);
+}
+
+// milliseconds between two simulation steps at a speed setting
+static inline int MatrixStepTime (int speed)
+{
+	return ((SPEED_MAX - speed) + SPEED_MIN) * 10;
+}
+
+// zero picks the default size, glyphs keep their aspect ratio
+static inline int MatrixCellSize (int cell_size)
+{
+	if (!cell_size)
+		return CELL_SIZE_DEFAULT;
+
+	return (cell_size < CELL_SIZE_MIN) ? CELL_SIZE_MIN : (cell_size > CELL_SIZE_MAX) ? CELL_SIZE_MAX : cell_size;
+}
+
+// column length in glyphs with the padding, rounded up to cache lines
+static inline size_t MatrixStride (int numrows)
+{
+	return (numrows + GLYPH_PAD + (GLYPH_ARENA_ALIGN / sizeof (GLYPH)) - 1) & ~((GLYPH_ARENA_ALIGN / sizeof (GLYPH)) - 1);
+}
+
+// words of the dirty bitset of a column
+static inline size_t MatrixDirtyStride (size_t stride)
+{
+	return (stride + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS;
+}
+
+// the glyph at row "y" needs to be drawn again
+static inline void MatrixSetDirty (PMATRIX_COLUMN column, int y)
+{
+	column->dirty[y / DIRTY_WORD_BITS] |= 1ull << (y % DIRTY_WORD_BITS);
+}
+
+// rows of dirty word "word" which are in view
+static inline uint64_t MatrixDirtyRowMask (int length, int word)
+{
+	int rows = length - (word * DIRTY_WORD_BITS);
+
+	if (rows >= DIRTY_WORD_BITS)
+		return ~0ull;
+
+	return (rows > 0) ? ((1ull << rows) - 1) : 0;
+}
+
+// ticks until every column has started and a run may have reached the bottom
+static inline int MatrixPrewarmTicks (PMATRIX matrix)
+{
+	return COUNTDOWN_MAX + matrix->numrows;
+}
+
+//
+//	Blips are drawn at full intensity over the brightest glyphs. Returns
+//	the blip rows of the dirty word starting at row "base", so the blip
+//	is not tested again for every glyph.
+//
+static inline uint64_t GlyphBlipMask (PMATRIX_COLUMN column, int base)
+{
+	static const int offset[4] = {0, 1, 8, 9};
+	uint64_t mask = 0;
+	unsigned row;
+
+	for (int i = 0; i < 4; i++)
+	{
+		row = (unsigned)(column->blip_pos + offset[i] - base);
+
+		if (row < DIRTY_WORD_BITS)
+			mask |= 1ull << row;
+	}
+
+	return mask;
+}
+
+// a zero seed picks a random one, a zero cell size the default
+PMATRIX CreateMatrix (int width, int height, int cell_size, uint64_t seed, const MATRIX_HOOKS *hooks);
+void DestroyMatrix (PMATRIX matrix);
+
+// (re)starts column "x" with its own stream and zero glyphs in view
+void InitMatrixColumn (PMATRIX matrix, int x);
+
+// blips on screen are erased when they get switched off
+void SetMatrixBlips (PMATRIX matrix, bool is_enabled);
+
+void RandomMatrixColumn (PMATRIX matrix, PMATRIX_COLUMN column);
+void ScrollMatrixColumn (PMATRIX matrix, PMATRIX_COLUMN column);
+
+// same as ScrollMatrixColumn on every column, vectorized where possible
+void ScrollMatrixColumns (PMATRIX matrix, int first, int count);
+
+void UpdateMatrixColumn (PMATRIX matrix, PMATRIX_COLUMN column);
+void UpdateMatrixColumns (PMATRIX matrix, int first, int count);
+
+//
+//	Fast-forwards "ticks" updates of a column range without flagging any
+//	glyph for redraw, then flags every glyph in view, so the next frame
+//	is drawn in full. The columns end up exactly as after as many
+//	UpdateMatrixColumns calls, a new matrix looks like it has been
+//	running for a while. Distinct ranges may run on different threads.
+//
+void PrewarmMatrixColumns (PMATRIX matrix, int first, int count, int ticks);
@@ -0,0 +1,175 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "overlay.h"
+
+//
+//	Characters 0x20-0x5F, three bits per row from the top, the
+//	leftmost pixel in the highest bit. Lowercase is drawn uppercase.
+//
+static const uint16_t overlay_font[64] = {
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x52A5, 0x0000, 0x0000, //  !"#$%&'
+	0x2922, 0x224A, 0x0000, 0x05D0, 0x0014, 0x01C0, 0x0002, 0x12A4, // ()*+,-./
+	0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249, // 01234567
+	0x7BEF, 0x7BCF, 0x0410, 0x0000, 0x0000, 0x0E38, 0x0000, 0x0000, // 89:;<=>?
+	0x0000, 0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B, // @ABCDEFG
+	0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D, 0x2B6A, // HIJKLMNO
+	0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD, // PQRSTUVW
+	0x5AAD, 0x5A92, 0x72A7, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, // XYZ[\]^_
+};
+
+static uint16_t GetOverlayChar (char ch)
+{
+	if (ch >= 'a' && ch <= 'z')
+		ch = (char)(ch - ('a' - 'A'));
+
+	if (ch < 0x20 || ch > 0x5F)
+		return 0;
+
+	return overlay_font[ch - 0x20];
+}
+
+void MeasureOverlay (const char *text, int scale, int *width, int *height)
+{
+	int columns = 0;
+	int lines = 1;
+	int length = 0;
+
+	for (; *text; text++)
+	{
+		if (*text == '\n')
+		{
+			lines += 1;
+			length = 0;
+
+			continue;
+		}
+
+		if (++length > columns)
+			columns = length;
+	}
+
+	// one spare character cell as border on every side
+	*width = (columns + 1) * OVERLAY_CHAR_WIDTH * scale;
+	*height = (lines * OVERLAY_CHAR_HEIGHT + OVERLAY_CHAR_WIDTH) * scale;
+}
+
+static void FillOverlayRect (PFRAMEBUFFER framebuffer, int left, int top, int right, int bottom, uint32_t color)
+{
+	uint32_t *row;
+
+	for (int y = top; y < bottom; y++)
+	{
+		row = framebuffer->pixels + (y * framebuffer->stride);
+
+		for (int x = left; x < right; x++)
+			row[x] = color;
+	}
+}
+
+static int ClampOverlay (int value, int limit)
+{
+	return (value < 0) ? 0 : ((value > limit) ? limit : value);
+}
+
+void DrawOverlay (PMATRIX matrix, int left, int top, const char *text, int scale, uint32_t color)
+{
+	PFRAMEBUFFER framebuffer = matrix->framebuffer;
+	PMATRIX_COLUMN column;
+	uint16_t pattern;
+	int width;
+	int height;
+	int right;
+	int bottom;
+	int x;
+	int y;
+
+	if (!framebuffer || scale < 1)
+		return;
+
+	MeasureOverlay (text, scale, &width, &height);
+
+	right = ClampOverlay (left + width, matrix->width);
+	bottom = ClampOverlay (top + height, matrix->height);
+	left = ClampOverlay (left, matrix->width);
+	top = ClampOverlay (top, matrix->height);
+
+	if (left >= right || top >= bottom)
+		return;
+
+	FillOverlayRect (framebuffer, left, top, right, bottom, 0);
+
+	x = left + (OVERLAY_CHAR_WIDTH * scale / 2);
+	y = top + (OVERLAY_CHAR_WIDTH * scale / 2);
+
+	for (; *text; text++)
+	{
+		if (*text == '\n')
+		{
+			x = left + (OVERLAY_CHAR_WIDTH * scale / 2);
+			y += OVERLAY_CHAR_HEIGHT * scale;
+
+			continue;
+		}
+
+		pattern = GetOverlayChar (*text);
+
+		for (int i = 0; i < 15; i++)
+		{
+			if (!(pattern & (0x4000 >> i)))
+				continue;
+
+			FillOverlayRect (
+				framebuffer,
+				ClampOverlay (x + (i % 3) * scale, right),
+				ClampOverlay (y + (i / 3) * scale, bottom),
+				ClampOverlay (x + (i % 3 + 1) * scale, right),
+				ClampOverlay (y + (i / 3 + 1) * scale, bottom),
+				color
+			);
+		}
+
+		x += OVERLAY_CHAR_WIDTH * scale;
+	}
+
+	AddDirtyRect (&framebuffer->dirty, left, top, right, bottom);
+
+	// glyphs below the box repaint it next frame
+	for (int cx = left / matrix->cell_width; cx <= (right - 1) / matrix->cell_width && cx < matrix->numcols; cx++)
+	{
+		column = &matrix->column[cx];
+
+		for (int cy = top / matrix->cell_height; cy <= (bottom - 1) / matrix->cell_height && cy < column->length; cy++)
+			MatrixSetDirty (column, cy);
+	}
+}
+
+uint32_t GetOverlayColor (const GLYPH_ATLAS *atlas)
+{
+	const uint32_t *row;
+	uint32_t color = 0x00FFFFFF;
+	int brightest = -1;
+	int value;
+
+	if (!atlas || !atlas->pixels)
+		return color;
+
+	// the blip row holds the brightest colours
+	for (int y = 0; y < atlas->cell_height && (MAX_INTENSITY * atlas->cell_height) + y < atlas->height; y++)
+	{
+		row = atlas->pixels + (((MAX_INTENSITY * atlas->cell_height) + y) * atlas->stride);
+
+		for (int x = 0; x < atlas->width; x++)
+		{
+			value = (int)(row[x] & 0xFF) + (int)((row[x] >> 8) & 0xFF) + (int)((row[x] >> 16) & 0xFF);
+
+			if (value > brightest)
+			{
+				brightest = value;
+				color = row[x];
+			}
+		}
+	}
+
+	return color;
+}
@@ -0,0 +1,23 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include "render.h"
+
+// built-in 3x5 font, every character takes 4x6 pixels with spacing
+#define OVERLAY_CHAR_WIDTH 4
+#define OVERLAY_CHAR_HEIGHT 6
+
+// size of the text box including its border, lines are separated by '\n'
+void MeasureOverlay (const char *text, int scale, int *width, int *height);
+
+//
+//	Draw a text box into the framebuffer after RenderMatrix. The box is
+//	added to the dirty region and the glyphs below it are flagged for
+//	redraw, so it disappears once it is no longer drawn.
+//
+void DrawOverlay (PMATRIX matrix, int left, int top, const char *text, int scale, uint32_t color);
+
+// brightest colour of the atlas, so the overlay follows the current hue
+uint32_t GetOverlayColor (const GLYPH_ATLAS *atlas);
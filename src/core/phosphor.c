@@ -0,0 +1,379 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include <string.h>
+
+#include "phosphor.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#endif
+
+typedef void (*TILE_FADE) (uint32_t *dst, ptrdiff_t stride, int width, int height, int decay);
+typedef void (*TILE_BLEND) (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height);
+
+typedef struct _PHOSPHOR_KERNELS
+{
+	TILE_FADE fade;
+	TILE_BLEND blend;
+} PHOSPHOR_KERNELS;
+
+//
+//	Two channels at a time, 8 bits apart. A channel times a decay
+//	below 256 stays within 16 bits, so it never carries into the next.
+//
+static inline uint32_t FadePixel (uint32_t pixel, uint32_t decay)
+{
+	return ((((pixel & 0x00FF00FF) * decay) >> 8) & 0x00FF00FF) | ((((pixel >> 8) & 0x00FF00FF) * decay) & 0xFF00FF00);
+}
+
+static inline uint32_t BlendPixel (uint32_t dst, uint32_t src)
+{
+	uint32_t result = 0;
+	uint32_t a;
+	uint32_t b;
+
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		a = (dst >> shift) & 0xFF;
+		b = (src >> shift) & 0xFF;
+
+		result |= ((a > b) ? a : b) << shift;
+	}
+
+	return result;
+}
+
+static void FadeTileScalar (uint32_t *dst, ptrdiff_t stride, int width, int height, int decay)
+{
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+			dst[x] = FadePixel (dst[x], (uint32_t)decay);
+
+		dst += stride;
+	}
+}
+
+static void BlendTileScalar (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+			dst[x] = BlendPixel (dst[x], src[x]);
+
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+#if defined(CPU_X86)
+
+//
+//	Channels are widened to 16 bits, multiplied, shifted back and packed
+//	with saturation. A fade must not be applied twice, so the pixels
+//	left over by the vectors take the scalar path, while the maximum of
+//	a blend does not mind the overlapping last chunk CopyTile uses.
+//
+CPU_TARGET_SSE2 static void FadeTileSse2 (uint32_t *dst, ptrdiff_t stride, int width, int height, int decay)
+{
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i factor = _mm_set1_epi16 ((short)decay);
+	__m128i value;
+	__m128i lo;
+	__m128i hi;
+	int x;
+
+	for (int y = 0; y < height; y++)
+	{
+		for (x = 0; x + 4 <= width; x += 4)
+		{
+			value = _mm_loadu_si128 ((const __m128i *)(dst + x));
+
+			lo = _mm_srli_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (value, zero), factor), 8);
+			hi = _mm_srli_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (value, zero), factor), 8);
+
+			_mm_storeu_si128 ((__m128i *)(dst + x), _mm_packus_epi16 (lo, hi));
+		}
+
+		for (; x < width; x++)
+			dst[x] = FadePixel (dst[x], (uint32_t)decay);
+
+		dst += stride;
+	}
+}
+
+CPU_TARGET_SSE2 static void BlendTileSse2 (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	int last = width - 4;
+
+	if (last < 0)
+	{
+		BlendTileScalar (dst, dst_stride, src, src_stride, width, height);
+		return;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < last; x += 4)
+			_mm_storeu_si128 ((__m128i *)(dst + x), _mm_max_epu8 (_mm_loadu_si128 ((const __m128i *)(dst + x)), _mm_loadu_si128 ((const __m128i *)(src + x))));
+
+		_mm_storeu_si128 ((__m128i *)(dst + last), _mm_max_epu8 (_mm_loadu_si128 ((const __m128i *)(dst + last)), _mm_loadu_si128 ((const __m128i *)(src + last))));
+
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+CPU_TARGET_AVX2 static void FadeTileAvx2 (uint32_t *dst, ptrdiff_t stride, int width, int height, int decay)
+{
+	__m256i zero = _mm256_setzero_si256 ();
+	__m256i factor = _mm256_set1_epi16 ((short)decay);
+	__m256i value;
+	__m256i lo;
+	__m256i hi;
+	int x;
+
+	for (int y = 0; y < height; y++)
+	{
+		// unpacking and packing stay within the lanes, so the order holds
+		for (x = 0; x + 8 <= width; x += 8)
+		{
+			value = _mm256_loadu_si256 ((const __m256i *)(dst + x));
+
+			lo = _mm256_srli_epi16 (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (value, zero), factor), 8);
+			hi = _mm256_srli_epi16 (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (value, zero), factor), 8);
+
+			_mm256_storeu_si256 ((__m256i *)(dst + x), _mm256_packus_epi16 (lo, hi));
+		}
+
+		for (; x < width; x++)
+			dst[x] = FadePixel (dst[x], (uint32_t)decay);
+
+		dst += stride;
+	}
+}
+
+CPU_TARGET_AVX2 static void BlendTileAvx2 (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	int last = width - 8;
+
+	if (last < 0)
+	{
+		BlendTileSse2 (dst, dst_stride, src, src_stride, width, height);
+		return;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < last; x += 8)
+			_mm256_storeu_si256 ((__m256i *)(dst + x), _mm256_max_epu8 (_mm256_loadu_si256 ((const __m256i *)(dst + x)), _mm256_loadu_si256 ((const __m256i *)(src + x))));
+
+		_mm256_storeu_si256 ((__m256i *)(dst + last), _mm256_max_epu8 (_mm256_loadu_si256 ((const __m256i *)(dst + last)), _mm256_loadu_si256 ((const __m256i *)(src + last))));
+
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+#endif // CPU_X86
+
+static const PHOSPHOR_KERNELS *GetPhosphorKernels (void)
+{
+	static const PHOSPHOR_KERNELS scalar = {&FadeTileScalar, &BlendTileScalar};
+
+#if defined(CPU_X86)
+	static const PHOSPHOR_KERNELS sse2 = {&FadeTileSse2, &BlendTileSse2};
+	static const PHOSPHOR_KERNELS avx2 = {&FadeTileAvx2, &BlendTileAvx2};
+
+	uint32_t features = CpuGetFeatures ();
+
+	if (features & CPU_FEATURE_AVX2)
+		return &avx2;
+
+	if (features & CPU_FEATURE_SSE2)
+		return &sse2;
+#endif
+
+	return &scalar;
+}
+
+static inline int ClampDecay (int decay)
+{
+	return (decay < PHOSPHOR_DECAY_MIN) ? PHOSPHOR_DECAY_MIN : (decay > PHOSPHOR_DECAY_MAX) ? PHOSPHOR_DECAY_MAX : decay;
+}
+
+int PhosphorFadeFrames (int decay)
+{
+	int frames = 0;
+
+	decay = ClampDecay (decay);
+
+	for (int value = 0xFF; value; value = (value * decay) >> 8)
+		frames += 1;
+
+	return frames;
+}
+
+// lit glyphs or pixels drawn over since the last frame
+static bool IsColumnLit (PMATRIX matrix, PMATRIX_COLUMN column)
+{
+	int words = (int)MatrixDirtyStride (matrix->stride);
+	int bottom = (column->lit_bottom < column->length) ? column->lit_bottom : column->length;
+
+	// nothing is lit in waiting and idle columns
+	if (column->is_started && !column->idle_ticks && column->lit_top < bottom)
+		return true;
+
+	for (int w = 0; w < words; w++)
+	{
+		if (column->dirty[w] & MatrixDirtyRowMask (column->length, w))
+			return true;
+	}
+
+	return false;
+}
+
+//
+//	Fades and blends neighbouring columns which still glow. Tiles span
+//	the whole run and as many glyph rows as fit PHOSPHOR_TILE_BYTES, at
+//	most one dirty word, so a single blip mask covers the tile.
+//
+static size_t DrawPhosphorRun (PMATRIX matrix, const GLYPH_ATLAS *atlas, const PHOSPHOR_KERNELS *kernels, int first, int count, int decay)
+{
+	PFRAMEBUFFER framebuffer = matrix->framebuffer;
+	PMATRIX_COLUMN column;
+	uint32_t *pixels = framebuffer->pixels + (first * matrix->cell_width);
+	uint32_t *dst;
+	uint64_t blip;
+	size_t drawn = 0;
+	size_t row_bytes = (size_t)count * matrix->cell_width * matrix->cell_height * sizeof (uint32_t);
+	GLYPH glyph;
+	int tile_rows = (int)(PHOSPHOR_TILE_BYTES / row_bytes);
+	int bottom;
+	int start;
+	int end;
+
+	if (tile_rows < 1)
+		tile_rows = 1;
+
+	if (tile_rows > DIRTY_WORD_BITS)
+		tile_rows = DIRTY_WORD_BITS;
+
+	for (int top = 0; top < matrix->numrows; top += tile_rows)
+	{
+		bottom = (top + tile_rows < matrix->numrows) ? (top + tile_rows) : matrix->numrows;
+
+		kernels->fade (pixels + (top * matrix->cell_height * framebuffer->stride), framebuffer->stride, count * matrix->cell_width, (bottom - top) * matrix->cell_height, decay);
+
+		for (int x = first; x < first + count; x++)
+		{
+			column = &matrix->column[x];
+
+			if (!column->is_started || column->idle_ticks)
+				continue;
+
+			start = (column->lit_top > top) ? column->lit_top : top;
+			end = (column->lit_bottom < bottom) ? column->lit_bottom : bottom;
+
+			if (end > column->length)
+				end = column->length;
+
+			if (start >= end)
+				continue;
+
+			dst = framebuffer->pixels + (x * matrix->cell_width);
+			blip = matrix->is_blips ? GlyphBlipMask (column, top) : 0;
+
+			for (int y = start; y < end; y++)
+			{
+				glyph = column->glyph[y];
+
+				// black never shows over the trails
+				if (!GlyphIntensity (glyph))
+					continue;
+
+				if ((GlyphIntensity (glyph) >= MAX_INTENSITY - 1) && ((blip >> (y - top)) & 1))
+					glyph |= GLYPH_MAKE (MAX_INTENSITY, 0);
+
+				kernels->blend (dst + (y * matrix->cell_height * framebuffer->stride), framebuffer->stride, AtlasGlyphPixels (atlas, glyph), atlas->stride, matrix->cell_width, matrix->cell_height);
+
+				drawn += 1;
+			}
+		}
+	}
+
+	return drawn;
+}
+
+size_t DrawPhosphorColumns (PMATRIX matrix, const GLYPH_ATLAS *atlas, int first, int count, int decay)
+{
+	const PHOSPHOR_KERNELS *kernels;
+	PMATRIX_COLUMN column;
+	size_t drawn = 0;
+	int words = (int)MatrixDirtyStride (matrix->stride);
+	int frames;
+	int run;
+	int x;
+
+	if (!matrix->framebuffer || !atlas || !atlas->pixels || atlas->columns <= 0)
+		return 0;
+
+	// scaled for another cell size
+	if (atlas->cell_width != matrix->cell_width || atlas->cell_height != matrix->cell_height)
+		return 0;
+
+	decay = ClampDecay (decay);
+	frames = PhosphorFadeFrames (decay);
+	kernels = GetPhosphorKernels ();
+
+	// whatever is lit now is black once it faded for that many frames
+	for (x = first; x < first + count; x++)
+	{
+		column = &matrix->column[x];
+
+		if (IsColumnLit (matrix, column))
+			column->afterglow = frames;
+	}
+
+	for (x = first; x < first + count; x = run)
+	{
+		for (run = x; run < first + count && matrix->column[run].afterglow; run++)
+			;
+
+		if (run > x)
+			drawn += DrawPhosphorRun (matrix, atlas, kernels, x, run - x, decay);
+		else
+			run += 1;
+	}
+
+	// clear redraw state, blips leave bits in the padding as well
+	for (x = first; x < first + count; x++)
+	{
+		column = &matrix->column[x];
+
+		if (column->afterglow)
+			column->afterglow -= 1;
+
+		memset (column->dirty, 0, words * sizeof (uint64_t));
+	}
+
+	return drawn;
+}
+
+size_t RenderPhosphor (PMATRIX matrix, const GLYPH_ATLAS *atlas, int decay)
+{
+	size_t count;
+
+	if (!matrix->framebuffer || !atlas || !atlas->pixels)
+		return 0;
+
+	count = DrawPhosphorColumns (matrix, atlas, 0, matrix->numcols, decay);
+
+	// the redraw flags are gone, this only starts a new region
+	BuildDirtyRegion (matrix);
+	AddDirtyRect (&matrix->framebuffer->dirty, 0, 0, matrix->width, matrix->height);
+
+	return count;
+}
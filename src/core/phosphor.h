@@ -0,0 +1,36 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include "render.h"
+
+// brightness kept by every frame, in 1/256, zero switches the mode off
+#define PHOSPHOR_DECAY_MIN 1
+#define PHOSPHOR_DECAY_MAX 255
+
+// pixels faded and blended in one go, sized to stay in the l2 cache
+#define PHOSPHOR_TILE_BYTES (64 * 1024)
+
+// frames until a fully lit pixel has faded to black
+int PhosphorFadeFrames (int decay);
+
+//
+//	Phosphor persistence instead of redrawing changed glyphs. Every
+//	channel of the framebuffer is scaled by "decay" / 256, rounding
+//	down, then the lit glyphs of the columns are blended on top with a
+//	per channel maximum, so glyphs leave continuous trails behind. Both
+//	passes run over tiles of whole column ranges and a few glyph rows,
+//	each tile is blended while it is still in the cache. Columns which
+//	are dark for PhosphorFadeFrames are known to be black and skipped.
+//
+//	Distinct column ranges may be drawn from different threads. The
+//	redraw flags of the columns are cleared, every pixel may have
+//	changed so the whole frame has to be presented. Returns the number
+//	of glyphs blended, nothing gets drawn with an atlas of another cell
+//	size. Every simd path produces identical output.
+//
+size_t DrawPhosphorColumns (PMATRIX matrix, const GLYPH_ATLAS *atlas, int first, int count, int decay);
+
+// RenderMatrix with phosphor persistence, the dirty region covers the frame
+size_t RenderPhosphor (PMATRIX matrix, const GLYPH_ATLAS *atlas, int decay);
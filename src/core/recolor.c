@@ -0,0 +1,301 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "recolor.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#endif
+
+#define HLS_HALF (HLS_MAX / 2)
+#define RGB_MAX 255
+
+//
+//	ColorHLSToRGB interpolates every channel between two magic values,
+//	the weight (0-40) depends on the hue only. Computing the weights once
+//	per hue leaves a few multiplies and constant divisions per pixel,
+//	which map onto 16-bit simd lanes.
+//
+static int HueWeight (int hue)
+{
+	hue = (hue > HLS_MAX) ? hue - HLS_MAX : (hue < 0) ? hue + HLS_MAX : hue;
+
+	if (hue > 160)
+		return 0;
+
+	if (hue > 120)
+		return 160 - hue;
+
+	if (hue > 40)
+		return 40;
+
+	return hue;
+}
+
+static inline int HueChannel (int mid1, int mid2, int weight)
+{
+	int value = ((weight * (mid2 - mid1) + 20) / 40) + mid1;
+
+	return (value * RGB_MAX + HLS_HALF) / HLS_MAX;
+}
+
+static inline uint32_t HlsToRgbWeighted (int l, int s, const int weight[3])
+{
+	int mid1;
+	int mid2;
+	int r, g, b;
+
+	if (!s)
+	{
+		r = l * RGB_MAX / HLS_MAX;
+
+		return (uint32_t)(r | (r << 8) | (r << 16));
+	}
+
+	if (l > HLS_HALF)
+		mid2 = s + l - (s * l + HLS_HALF) / HLS_MAX;
+	else
+		mid2 = ((s + HLS_MAX) * l + HLS_HALF) / HLS_MAX;
+
+	mid1 = l * 2 - mid2;
+
+	r = HueChannel (mid1, mid2, weight[0]);
+	g = HueChannel (mid1, mid2, weight[1]);
+	b = HueChannel (mid1, mid2, weight[2]);
+
+	return (uint32_t)(r | (g << 8) | (b << 16));
+}
+
+static void HueWeights (int hue, int weight[3])
+{
+	// the hue is periodic, fold it so the single wrap in HueWeight is enough
+	hue %= HLS_MAX;
+
+	if (hue < 0)
+		hue += HLS_MAX;
+
+	weight[0] = HueWeight (hue + (HLS_MAX / 3));
+	weight[1] = HueWeight (hue);
+	weight[2] = HueWeight (hue - (HLS_MAX / 3));
+}
+
+void RgbToHls (uint32_t clr, uint16_t *h, uint16_t *l, uint16_t *s)
+{
+	int r = clr & 0xFF;
+	int g = (clr >> 8) & 0xFF;
+	int b = (clr >> 16) & 0xFF;
+
+	int max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+	int min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+
+	int hue;
+	int lum;
+	int sat;
+
+	lum = ((max + min) * HLS_MAX + RGB_MAX) / (RGB_MAX * 2);
+
+	if (max == min)
+	{
+		// achromatic, hue is undefined but this is what shlwapi returns
+		sat = 0;
+		hue = 160;
+	}
+	else
+	{
+		int delta = max - min;
+		int r_norm;
+		int g_norm;
+		int b_norm;
+
+		if (lum <= HLS_HALF)
+			sat = ((max + min) / 2 + delta * HLS_MAX) / (max + min);
+		else
+			sat = (((RGB_MAX * 2) - max - min) / 2 + delta * HLS_MAX) / ((RGB_MAX * 2) - max - min);
+
+		r_norm = (delta / 2 + max * 40 - r * 40) / delta;
+		g_norm = (delta / 2 + max * 40 - g * 40) / delta;
+		b_norm = (delta / 2 + max * 40 - b * 40) / delta;
+
+		if (r == max)
+			hue = b_norm - g_norm;
+		else if (g == max)
+			hue = 80 + r_norm - b_norm;
+		else
+			hue = 160 + g_norm - r_norm;
+
+		if (hue < 0)
+			hue += HLS_MAX;
+		else if (hue > HLS_MAX)
+			hue -= HLS_MAX;
+	}
+
+	if (h)
+		*h = (uint16_t)hue;
+
+	if (l)
+		*l = (uint16_t)lum;
+
+	if (s)
+		*s = (uint16_t)sat;
+}
+
+uint32_t HlsToRgb (int h, int l, int s)
+{
+	int weight[3];
+
+	HueWeights (h, weight);
+
+	return HlsToRgbWeighted (l, s, weight);
+}
+
+static void RecolorPixelsScalar (uint32_t *dest, const uint8_t *saturation, const uint8_t *luminance, size_t count, const int weight[3])
+{
+	for (size_t i = 0; i < count; i++)
+		dest[i] = HlsToRgbWeighted (luminance[i], saturation[i], weight);
+}
+
+#if defined(CPU_X86)
+
+//
+//	Every intermediate value fits into an unsigned 16-bit lane (the largest
+//	is 240 * 255 + 120), so divisions by 40 and 240 become a high multiply
+//	with a rounded-up reciprocal and a shift. Both are exact over that range.
+//
+#define DIV40_MUL 52429 // ceil (2^21 / 40)
+#define DIV40_SHIFT 5
+#define DIV240_MUL 34953 // ceil (2^23 / 240)
+#define DIV240_SHIFT 7
+
+CPU_TARGET_SSE2 static void RecolorPixelsSse2 (uint32_t *dest, const uint8_t *saturation, const uint8_t *luminance, size_t count, const int weight[3])
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i c20 = _mm_set1_epi16 (20);
+	const __m128i half = _mm_set1_epi16 (HLS_HALF);
+	const __m128i hls_max = _mm_set1_epi16 (HLS_MAX);
+	const __m128i rgb_max = _mm_set1_epi16 (RGB_MAX);
+	const __m128i div40 = _mm_set1_epi16 ((short)DIV40_MUL);
+	const __m128i div240 = _mm_set1_epi16 ((short)DIV240_MUL);
+	const __m128i weight_r = _mm_set1_epi16 ((short)weight[0]);
+	const __m128i weight_g = _mm_set1_epi16 ((short)weight[1]);
+	const __m128i weight_b = _mm_set1_epi16 ((short)weight[2]);
+
+	size_t i = 0;
+
+#define SSE2_DIV40(x) _mm_srli_epi16 (_mm_mulhi_epu16 ((x), div40), DIV40_SHIFT)
+#define SSE2_DIV240(x) _mm_srli_epi16 (_mm_mulhi_epu16 ((x), div240), DIV240_SHIFT)
+#define SSE2_SELECT(mask, a, b) _mm_or_si128 (_mm_and_si128 ((mask), (a)), _mm_andnot_si128 ((mask), (b)))
+#define SSE2_CHANNEL(w) SSE2_DIV240 (_mm_add_epi16 (_mm_mullo_epi16 (_mm_add_epi16 (mid1, SSE2_DIV40 (_mm_add_epi16 (_mm_mullo_epi16 ((w), delta), c20))), rgb_max), half))
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i s = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(saturation + i)), zero);
+		__m128i l = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(luminance + i)), zero);
+
+		__m128i mid2_dark = SSE2_DIV240 (_mm_add_epi16 (_mm_mullo_epi16 (_mm_add_epi16 (s, hls_max), l), half));
+		__m128i mid2_light = _mm_sub_epi16 (_mm_add_epi16 (s, l), SSE2_DIV240 (_mm_add_epi16 (_mm_mullo_epi16 (s, l), half)));
+		__m128i mid2 = SSE2_SELECT (_mm_cmpgt_epi16 (l, half), mid2_light, mid2_dark);
+		__m128i mid1 = _mm_sub_epi16 (_mm_add_epi16 (l, l), mid2);
+		__m128i delta = _mm_sub_epi16 (mid2, mid1);
+
+		__m128i gray = SSE2_DIV240 (_mm_mullo_epi16 (l, rgb_max));
+		__m128i is_gray = _mm_cmpeq_epi16 (s, zero);
+
+		__m128i r = SSE2_SELECT (is_gray, gray, SSE2_CHANNEL (weight_r));
+		__m128i g = SSE2_SELECT (is_gray, gray, SSE2_CHANNEL (weight_g));
+		__m128i b = SSE2_SELECT (is_gray, gray, SSE2_CHANNEL (weight_b));
+
+		__m128i rg = _mm_or_si128 (r, _mm_slli_epi16 (g, 8));
+
+		_mm_storeu_si128 ((__m128i *)(dest + i + 0), _mm_unpacklo_epi16 (rg, b));
+		_mm_storeu_si128 ((__m128i *)(dest + i + 4), _mm_unpackhi_epi16 (rg, b));
+	}
+
+#undef SSE2_CHANNEL
+#undef SSE2_SELECT
+#undef SSE2_DIV240
+#undef SSE2_DIV40
+
+	RecolorPixelsScalar (dest + i, saturation + i, luminance + i, count - i, weight);
+}
+
+CPU_TARGET_AVX2 static void RecolorPixelsAvx2 (uint32_t *dest, const uint8_t *saturation, const uint8_t *luminance, size_t count, const int weight[3])
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const __m256i c20 = _mm256_set1_epi16 (20);
+	const __m256i half = _mm256_set1_epi16 (HLS_HALF);
+	const __m256i hls_max = _mm256_set1_epi16 (HLS_MAX);
+	const __m256i rgb_max = _mm256_set1_epi16 (RGB_MAX);
+	const __m256i div40 = _mm256_set1_epi16 ((short)DIV40_MUL);
+	const __m256i div240 = _mm256_set1_epi16 ((short)DIV240_MUL);
+	const __m256i weight_r = _mm256_set1_epi16 ((short)weight[0]);
+	const __m256i weight_g = _mm256_set1_epi16 ((short)weight[1]);
+	const __m256i weight_b = _mm256_set1_epi16 ((short)weight[2]);
+
+	size_t i = 0;
+
+#define AVX2_DIV40(x) _mm256_srli_epi16 (_mm256_mulhi_epu16 ((x), div40), DIV40_SHIFT)
+#define AVX2_DIV240(x) _mm256_srli_epi16 (_mm256_mulhi_epu16 ((x), div240), DIV240_SHIFT)
+#define AVX2_CHANNEL(w) AVX2_DIV240 (_mm256_add_epi16 (_mm256_mullo_epi16 (_mm256_add_epi16 (mid1, AVX2_DIV40 (_mm256_add_epi16 (_mm256_mullo_epi16 ((w), delta), c20))), rgb_max), half))
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i s = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)(saturation + i)));
+		__m256i l = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)(luminance + i)));
+
+		__m256i mid2_dark = AVX2_DIV240 (_mm256_add_epi16 (_mm256_mullo_epi16 (_mm256_add_epi16 (s, hls_max), l), half));
+		__m256i mid2_light = _mm256_sub_epi16 (_mm256_add_epi16 (s, l), AVX2_DIV240 (_mm256_add_epi16 (_mm256_mullo_epi16 (s, l), half)));
+		__m256i mid2 = _mm256_blendv_epi8 (mid2_dark, mid2_light, _mm256_cmpgt_epi16 (l, half));
+		__m256i mid1 = _mm256_sub_epi16 (_mm256_add_epi16 (l, l), mid2);
+		__m256i delta = _mm256_sub_epi16 (mid2, mid1);
+
+		__m256i gray = AVX2_DIV240 (_mm256_mullo_epi16 (l, rgb_max));
+		__m256i is_gray = _mm256_cmpeq_epi16 (s, zero);
+
+		__m256i r = _mm256_blendv_epi8 (AVX2_CHANNEL (weight_r), gray, is_gray);
+		__m256i g = _mm256_blendv_epi8 (AVX2_CHANNEL (weight_g), gray, is_gray);
+		__m256i b = _mm256_blendv_epi8 (AVX2_CHANNEL (weight_b), gray, is_gray);
+
+		__m256i rg = _mm256_or_si256 (r, _mm256_slli_epi16 (g, 8));
+
+		// unpack works per 128-bit lane, restore the pixel order afterwards
+		__m256i lo = _mm256_unpacklo_epi16 (rg, b);
+		__m256i hi = _mm256_unpackhi_epi16 (rg, b);
+
+		_mm256_storeu_si256 ((__m256i *)(dest + i + 0), _mm256_permute2x128_si256 (lo, hi, 0x20));
+		_mm256_storeu_si256 ((__m256i *)(dest + i + 8), _mm256_permute2x128_si256 (lo, hi, 0x31));
+	}
+
+#undef AVX2_CHANNEL
+#undef AVX2_DIV240
+#undef AVX2_DIV40
+
+	RecolorPixelsScalar (dest + i, saturation + i, luminance + i, count - i, weight);
+}
+
+#endif // CPU_X86
+
+void RecolorPixels (uint32_t *dest, const uint8_t *saturation, const uint8_t *luminance, size_t count, int hue)
+{
+	int weight[3];
+
+	HueWeights (hue, weight);
+
+#if defined(CPU_X86)
+	uint32_t features = CpuGetFeatures ();
+
+	if (features & CPU_FEATURE_AVX2)
+	{
+		RecolorPixelsAvx2 (dest, saturation, luminance, count, weight);
+		return;
+	}
+
+	if (features & CPU_FEATURE_SSE2)
+	{
+		RecolorPixelsSse2 (dest, saturation, luminance, count, weight);
+		return;
+	}
+#endif
+
+	RecolorPixelsScalar (dest, saturation, luminance, count, weight);
+}
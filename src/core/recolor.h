@@ -0,0 +1,24 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// shlwapi hls scale, hues wrap around at this value
+#define HLS_MAX 240
+
+//
+//	Integer port of ColorRGBToHLS/ColorHLSToRGB. Colours use the COLORREF
+//	layout (0x00BBGGRR) and the results are bit-exact with shlwapi.
+//
+void RgbToHls (uint32_t clr, uint16_t *h, uint16_t *l, uint16_t *s);
+uint32_t HlsToRgb (int h, int l, int s);
+
+//
+//	Recolor "count" pixels given as saturation and luminance planes (0-240)
+//	into COLORREF values with a new hue. Picks the widest simd path the
+//	cpu supports, every path produces identical output.
+//
+void RecolorPixels (uint32_t *dest, const uint8_t *saturation, const uint8_t *luminance, size_t count, int hue);
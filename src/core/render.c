@@ -0,0 +1,618 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include <string.h>
+
+#include "render.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#endif
+
+#define FRAMEBUFFER_ALIGN 64 // bytes
+
+typedef void (*TILE_COPY) (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height);
+
+static void CopyTileScalar (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	for (int y = 0; y < height; y++)
+	{
+		memcpy (dst, src, width * sizeof (uint32_t));
+
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+#if defined(CPU_X86)
+
+//
+//	Rows are copied in full vector chunks, the last chunk overlaps
+//	the previous one instead of falling back to narrower stores.
+//	A 14 pixel glyph row takes four sse2 or two avx2 moves.
+//
+CPU_TARGET_SSE2 static void CopyTileSse2 (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	int last = width - 4;
+
+	if (last < 0)
+	{
+		CopyTileScalar (dst, dst_stride, src, src_stride, width, height);
+		return;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < last; x += 4)
+			_mm_storeu_si128 ((__m128i *)(dst + x), _mm_loadu_si128 ((const __m128i *)(src + x)));
+
+		_mm_storeu_si128 ((__m128i *)(dst + last), _mm_loadu_si128 ((const __m128i *)(src + last)));
+
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+CPU_TARGET_AVX2 static void CopyTileAvx2 (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	int last = width - 8;
+
+	if (last < 0)
+	{
+		CopyTileSse2 (dst, dst_stride, src, src_stride, width, height);
+		return;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < last; x += 8)
+			_mm256_storeu_si256 ((__m256i *)(dst + x), _mm256_loadu_si256 ((const __m256i *)(src + x)));
+
+		_mm256_storeu_si256 ((__m256i *)(dst + last), _mm256_loadu_si256 ((const __m256i *)(src + last)));
+
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+#endif // CPU_X86
+
+static TILE_COPY GetTileCopy (void)
+{
+#if defined(CPU_X86)
+	uint32_t features = CpuGetFeatures ();
+
+	if (features & CPU_FEATURE_AVX2)
+		return &CopyTileAvx2;
+
+	if (features & CPU_FEATURE_SSE2)
+		return &CopyTileSse2;
+#endif
+
+	return &CopyTileScalar;
+}
+
+void CopyTile (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height)
+{
+	GetTileCopy () (dst, dst_stride, src, src_stride, width, height);
+}
+
+// round rows up to whole cache lines
+static inline ptrdiff_t FramebufferStride (int width)
+{
+	return (width + (FRAMEBUFFER_ALIGN / sizeof (uint32_t)) - 1) & ~((ptrdiff_t)(FRAMEBUFFER_ALIGN / sizeof (uint32_t)) - 1);
+}
+
+// pixels needed by the largest matrix the arena has room for
+static size_t FramebufferCapacity (int capacity, size_t stride, int cell_width, int cell_height)
+{
+	return (size_t)FramebufferStride (capacity * cell_width) * ((stride - GLYPH_PAD) * cell_height);
+}
+
+// header and pixels of "capacity" pixels at "block"
+static PFRAMEBUFFER InitFramebuffer (void *block, size_t capacity)
+{
+	PFRAMEBUFFER framebuffer = block;
+	uintptr_t pixels;
+
+	pixels = ((uintptr_t)(framebuffer + 1) + FRAMEBUFFER_ALIGN - 1) & ~(uintptr_t)(FRAMEBUFFER_ALIGN - 1);
+
+	framebuffer->pixels = (uint32_t *)pixels;
+	framebuffer->capacity = capacity;
+
+	return framebuffer;
+}
+
+PFRAMEBUFFER CreateMatrixFramebuffer (PMATRIX matrix)
+{
+	PFRAMEBUFFER framebuffer;
+	size_t capacity;
+
+	if (matrix->framebuffer)
+		return matrix->framebuffer;
+
+	capacity = FramebufferCapacity (matrix->capacity, matrix->stride, matrix->cell_width, matrix->cell_height);
+
+	// header and pixels share a single allocation
+	framebuffer = matrix->hooks.allocate (matrix->hooks.context, sizeof (FRAMEBUFFER) + FRAMEBUFFER_ALIGN + (capacity * sizeof (uint32_t)));
+
+	if (!framebuffer)
+		return NULL;
+
+	InitFramebuffer (framebuffer, capacity);
+
+	framebuffer->width = matrix->numcols * matrix->cell_width;
+	framebuffer->height = matrix->numrows * matrix->cell_height;
+	framebuffer->stride = FramebufferStride (framebuffer->width);
+
+	framebuffer->dirty.limit = DIRTY_RECTS_DEFAULT;
+
+	matrix->framebuffer = framebuffer;
+	matrix->is_framebuffer_inline = false;
+
+	return framebuffer;
+}
+
+//
+//	Moves pixel rows to another stride, both may be the same memory.
+//	Wider rows are moved bottom-up so no row gets overwritten before
+//	it was moved. Pixels which were not covered before are cleared.
+//
+static void MovePixels (uint32_t *dst, ptrdiff_t dst_stride, int width, int height, const uint32_t *src, ptrdiff_t src_stride, int src_width, int src_height)
+{
+	int copy_width = (src_width < width) ? src_width : width;
+	int copy_height = (src_height < height) ? src_height : height;
+	int y;
+
+	for (int i = 0; i < copy_height; i++)
+	{
+		y = (dst_stride > src_stride) ? (copy_height - 1 - i) : i;
+
+		memmove (dst + (y * dst_stride), src + (y * src_stride), copy_width * sizeof (uint32_t));
+		memset (dst + (y * dst_stride) + copy_width, 0, (width - copy_width) * sizeof (uint32_t));
+	}
+
+	for (y = copy_height; y < height; y++)
+		memset (dst + (y * dst_stride), 0, width * sizeof (uint32_t));
+}
+
+//
+//	Fits the framebuffer to the grid of the matrix. Pixels drawn at
+//	another cell size are of no use, they are cleared instead and
+//	every glyph in view gets drawn again.
+//
+static void ResizeFramebuffer (PMATRIX matrix, PFRAMEBUFFER framebuffer, const FRAMEBUFFER *source, bool is_rescaled)
+{
+	int width = matrix->numcols * matrix->cell_width;
+	int height = matrix->numrows * matrix->cell_height;
+	int words = (int)MatrixDirtyStride (matrix->stride);
+	ptrdiff_t stride = FramebufferStride (width);
+
+	MovePixels (framebuffer->pixels, stride, width, height, source->pixels, source->stride, is_rescaled ? 0 : source->width, is_rescaled ? 0 : source->height);
+
+	if (is_rescaled)
+	{
+		for (int x = 0; x < matrix->numcols; x++)
+		{
+			for (int w = 0; w < words; w++)
+				matrix->column[x].dirty[w] |= MatrixDirtyRowMask (matrix->column[x].length, w);
+		}
+	}
+
+	framebuffer->dirty.limit = source->dirty.limit;
+
+	framebuffer->width = width;
+	framebuffer->height = height;
+	framebuffer->stride = stride;
+}
+
+// fits columns to the new length and starts the new ones
+static void ResizeColumns (PMATRIX matrix, int numcols, int numrows)
+{
+	PMATRIX_COLUMN column;
+	int old_numcols = matrix->numcols;
+	int words = (int)MatrixDirtyStride (matrix->stride);
+
+	matrix->numcols = numcols;
+	matrix->numrows = numrows;
+
+	for (int x = 0; x < numcols && x < old_numcols; x++)
+	{
+		column = &matrix->column[x];
+
+		// rows coming into view held blip padding
+		if (numrows > column->length)
+		{
+			memset (column->glyph + column->length, 0, (numrows - column->length) * sizeof (GLYPH));
+
+			for (int w = column->length / DIRTY_WORD_BITS; w < words; w++)
+				column->dirty[w] &= MatrixDirtyRowMask (column->length, w);
+		}
+
+		column->length = numrows;
+	}
+
+	for (int x = old_numcols; x < numcols; x++)
+		InitMatrixColumn (matrix, x);
+}
+
+PMATRIX ResizeMatrix (PMATRIX matrix, int width, int height, int cell_size)
+{
+	PFRAMEBUFFER framebuffer = matrix->framebuffer;
+	PMATRIX resized;
+	uintptr_t grid;
+	size_t header_size;
+	size_t capacity = 0;
+	size_t stride;
+	size_t dirty_stride;
+	int cell_width = MatrixCellSize (cell_size);
+	int cell_height = cell_width * GLYPH_HEIGHT / GLYPH_WIDTH;
+	int numcols = width / cell_width + 1;
+	int numrows = height / cell_height + 1;
+	int count;
+	bool is_rescaled = (cell_width != matrix->cell_width || cell_height != matrix->cell_height);
+
+	// same grid, only the clipping changes
+	if (!is_rescaled && numcols == matrix->numcols && numrows == matrix->numrows)
+	{
+		matrix->width = width;
+		matrix->height = height;
+
+		return matrix;
+	}
+
+	// fits the arena and the pixels fit the framebuffer
+	if (numcols <= matrix->capacity && (size_t)numrows + GLYPH_PAD <= matrix->stride && (!framebuffer || (size_t)FramebufferStride (numcols * cell_width) * (numrows * cell_height) <= framebuffer->capacity))
+	{
+		ResizeColumns (matrix, numcols, numrows);
+
+		matrix->width = width;
+		matrix->height = height;
+		matrix->cell_width = cell_width;
+		matrix->cell_height = cell_height;
+
+		if (framebuffer)
+			ResizeFramebuffer (matrix, framebuffer, framebuffer, is_rescaled);
+
+		return matrix;
+	}
+
+	stride = MatrixStride (numrows);
+	dirty_stride = MatrixDirtyStride (stride);
+	header_size = sizeof (MATRIX) + (sizeof (MATRIX_COLUMN) * numcols);
+
+	if (framebuffer)
+		capacity = FramebufferCapacity (numcols, stride, cell_width, cell_height);
+
+	// header, columns, glyph grid, dirty bitsets and framebuffer
+	resized = matrix->hooks.allocate (matrix->hooks.context, header_size + GLYPH_ARENA_ALIGN + (stride * numcols * sizeof (GLYPH)) + (dirty_stride * numcols * sizeof (uint64_t)) + (framebuffer ? (sizeof (FRAMEBUFFER) + FRAMEBUFFER_ALIGN + (capacity * sizeof (uint32_t))) : 0));
+
+	if (!resized)
+		return NULL;
+
+	count = (numcols < matrix->numcols) ? numcols : matrix->numcols;
+
+	memcpy (resized, matrix, sizeof (MATRIX) + (sizeof (MATRIX_COLUMN) * count));
+
+	grid = ((uintptr_t)resized + header_size + GLYPH_ARENA_ALIGN - 1) & ~(uintptr_t)(GLYPH_ARENA_ALIGN - 1);
+
+	resized->grid = (PGLYPH)grid;
+	resized->dirty = (uint64_t *)(grid + (stride * numcols * sizeof (GLYPH)));
+	resized->stride = stride;
+	resized->capacity = numcols;
+	resized->numcols = count;
+	resized->width = width;
+	resized->height = height;
+	resized->cell_width = cell_width;
+	resized->cell_height = cell_height;
+
+	for (int x = 0; x < count; x++)
+	{
+		resized->column[x].glyph = resized->grid + (stride * x);
+
+		memcpy (resized->column[x].glyph, matrix->column[x].glyph, ((numrows < matrix->numrows) ? numrows : matrix->numrows) * sizeof (GLYPH));
+
+		resized->column[x].length = (numrows < matrix->numrows) ? numrows : matrix->numrows;
+
+		resized->column[x].dirty = resized->dirty + (dirty_stride * x);
+
+		memcpy (resized->column[x].dirty, matrix->column[x].dirty, ((dirty_stride < MatrixDirtyStride (matrix->stride)) ? dirty_stride : MatrixDirtyStride (matrix->stride)) * sizeof (uint64_t));
+	}
+
+	ResizeColumns (resized, numcols, numrows);
+
+	if (framebuffer)
+	{
+		resized->framebuffer = InitFramebuffer ((void *)(resized->dirty + (dirty_stride * numcols)), capacity);
+		resized->is_framebuffer_inline = true;
+
+		ResizeFramebuffer (resized, resized->framebuffer, framebuffer, is_rescaled);
+
+		if (!matrix->is_framebuffer_inline)
+			matrix->hooks.free (matrix->hooks.context, framebuffer);
+	}
+
+	matrix->hooks.free (matrix->hooks.context, matrix);
+
+	return resized;
+}
+
+//
+//	Spans of a column are merged into the rectangles which reached the
+//	previous column with the very same top and bottom, others start a
+//	new rectangle. Both lists are ordered from top to bottom.
+//
+typedef struct _DIRTY_BUILDER
+{
+	PDIRTY_REGION region;
+
+	int *open;
+	int *next_open;
+
+	int open_count;
+	int open_pos;
+	int next_count;
+} DIRTY_BUILDER, *PDIRTY_BUILDER;
+
+static void DirtyBeginColumn (PDIRTY_BUILDER builder)
+{
+	int *open = builder->open;
+
+	builder->open = builder->next_open;
+	builder->next_open = open;
+
+	builder->open_count = builder->next_count;
+	builder->open_pos = 0;
+	builder->next_count = 0;
+}
+
+static void DirtyAddSpan (PDIRTY_BUILDER builder, int x, int top, int bottom)
+{
+	PDIRTY_REGION region = builder->region;
+	PDIRTY_RECT rect;
+
+	if (region->is_full)
+		return;
+
+	while (builder->open_pos < builder->open_count && region->rect[builder->open[builder->open_pos]].top < top)
+		builder->open_pos += 1;
+
+	if (builder->open_pos < builder->open_count)
+	{
+		rect = &region->rect[builder->open[builder->open_pos]];
+
+		if (rect->top == top && rect->bottom == bottom)
+		{
+			rect->right = x + 1;
+
+			builder->next_open[builder->next_count++] = builder->open[builder->open_pos++];
+
+			return;
+		}
+	}
+
+	// too fragmented, present everything
+	if (region->count >= region->limit)
+	{
+		region->is_full = true;
+		return;
+	}
+
+	rect = &region->rect[region->count];
+
+	rect->left = x;
+	rect->top = top;
+	rect->right = x + 1;
+	rect->bottom = bottom;
+
+	builder->next_open[builder->next_count++] = region->count++;
+}
+
+// convert glyph rectangles into clipped pixel rectangles
+static void DirtyFinish (PDIRTY_REGION region, int width, int height, int cell_width, int cell_height)
+{
+	PDIRTY_RECT rect;
+	int count = 0;
+
+	if (region->is_full)
+	{
+		region->count = 0;
+		return;
+	}
+
+	for (int i = 0; i < region->count; i++)
+	{
+		rect = &region->rect[count];
+
+		rect->left = region->rect[i].left * cell_width;
+		rect->top = region->rect[i].top * cell_height;
+		rect->right = region->rect[i].right * cell_width;
+		rect->bottom = region->rect[i].bottom * cell_height;
+
+		if (rect->right > width)
+			rect->right = width;
+
+		if (rect->bottom > height)
+			rect->bottom = height;
+
+		if (rect->left < rect->right && rect->top < rect->bottom)
+			count += 1;
+	}
+
+	region->count = count;
+}
+
+size_t DrawMatrixColumns (PMATRIX matrix, const GLYPH_ATLAS *atlas, int first, int count)
+{
+	PFRAMEBUFFER framebuffer = matrix->framebuffer;
+	PMATRIX_COLUMN column;
+	TILE_COPY copy_tile;
+	const uint32_t *src;
+	uint32_t *dst;
+	uint64_t bits;
+	uint64_t blip;
+	size_t drawn = 0;
+	GLYPH glyph;
+	int words;
+	int bit;
+	int y;
+
+	if (!framebuffer || !atlas || !atlas->pixels || atlas->columns <= 0)
+		return 0;
+
+	// scaled for another cell size
+	if (atlas->cell_width != matrix->cell_width || atlas->cell_height != matrix->cell_height)
+		return 0;
+
+	copy_tile = GetTileCopy ();
+
+	for (int x = first; x < first + count; x++)
+	{
+		column = &matrix->column[x];
+		dst = framebuffer->pixels + (x * matrix->cell_width);
+		words = (column->length + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS;
+
+		// walk the dirty bits, so only what needs doing is visited
+		for (int w = 0; w < words; w++)
+		{
+			bits = column->dirty[w] & MatrixDirtyRowMask (column->length, w);
+
+			if (!bits)
+				continue;
+
+			blip = matrix->is_blips ? GlyphBlipMask (column, w * DIRTY_WORD_BITS) : 0;
+
+			do
+			{
+				bit = CpuLowestBit64 (bits);
+				bits &= bits - 1;
+
+				y = (w * DIRTY_WORD_BITS) + bit;
+				glyph = column->glyph[y];
+
+				if ((GlyphIntensity (glyph) >= MAX_INTENSITY - 1) && ((blip >> bit) & 1))
+					glyph |= GLYPH_MAKE (MAX_INTENSITY, 0);
+
+				src = AtlasGlyphPixels (atlas, glyph);
+
+				copy_tile (dst + (y * matrix->cell_height * framebuffer->stride), framebuffer->stride, src, atlas->stride, matrix->cell_width, matrix->cell_height);
+
+				drawn += 1;
+			}
+			while (bits);
+		}
+	}
+
+	return drawn;
+}
+
+void BuildDirtyRegion (PMATRIX matrix)
+{
+	PFRAMEBUFFER framebuffer = matrix->framebuffer;
+	DIRTY_BUILDER builder;
+	PMATRIX_COLUMN column;
+	uint64_t bits;
+	int words;
+	int span_top;
+	int span_bottom;
+	int y;
+
+	if (!framebuffer)
+		return;
+
+	builder.region = &framebuffer->dirty;
+	builder.open = framebuffer->dirty.open;
+	builder.next_open = framebuffer->dirty.next_open;
+	builder.next_count = 0;
+
+	framebuffer->dirty.count = 0;
+	framebuffer->dirty.is_full = (framebuffer->dirty.limit <= 0);
+
+	if (framebuffer->dirty.limit > DIRTY_RECTS_MAX)
+		framebuffer->dirty.limit = DIRTY_RECTS_MAX;
+
+	words = (int)MatrixDirtyStride (matrix->stride);
+
+	for (int x = 0; x < matrix->numcols; x++)
+	{
+		column = &matrix->column[x];
+
+		DirtyBeginColumn (&builder);
+
+		span_top = -1;
+		span_bottom = -1;
+
+		for (int w = 0; w < words; w++)
+		{
+			if (!column->dirty[w])
+				continue;
+
+			// clear redraw state, blips leave bits in the padding as well
+			bits = column->dirty[w] & MatrixDirtyRowMask (column->length, w);
+			column->dirty[w] = 0;
+
+			while (bits)
+			{
+				y = (w * DIRTY_WORD_BITS) + CpuLowestBit64 (bits);
+				bits &= bits - 1;
+
+				// grow the current span or start a new one
+				if (span_top >= 0 && (y - span_bottom) <= DIRTY_SPAN_GAP)
+				{
+					span_bottom = y + 1;
+				}
+				else
+				{
+					if (span_top >= 0)
+						DirtyAddSpan (&builder, x, span_top, span_bottom);
+
+					span_top = y;
+					span_bottom = y + 1;
+				}
+			}
+		}
+
+		if (span_top >= 0)
+			DirtyAddSpan (&builder, x, span_top, span_bottom);
+	}
+
+	DirtyFinish (&framebuffer->dirty, matrix->width, matrix->height, matrix->cell_width, matrix->cell_height);
+}
+
+void AddDirtyRect (PDIRTY_REGION region, int left, int top, int right, int bottom)
+{
+	PDIRTY_RECT rect;
+
+	if (region->is_full)
+		return;
+
+	if (region->count >= region->limit)
+	{
+		region->is_full = true;
+		region->count = 0;
+
+		return;
+	}
+
+	rect = &region->rect[region->count++];
+
+	rect->left = left;
+	rect->top = top;
+	rect->right = right;
+	rect->bottom = bottom;
+}
+
+size_t RenderMatrix (PMATRIX matrix, const GLYPH_ATLAS *atlas)
+{
+	size_t count;
+
+	if (!matrix->framebuffer || !atlas || !atlas->pixels)
+		return 0;
+
+	count = DrawMatrixColumns (matrix, atlas, 0, matrix->numcols);
+
+	BuildDirtyRegion (matrix);
+
+	return count;
+}
@@ -0,0 +1,127 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include "matrix.h"
+
+// glyph rows of an atlas band, the last one holds the blips
+#define ATLAS_LEVELS (MAX_INTENSITY + 1)
+
+//
+//	32-bit glyph bitmap, one row of glyphs per intensity level.
+//	The pixels point at the top-left corner, bottom-up bitmaps
+//	use a negative stride. Glyphs are drawn only when the cells
+//	match the cells of the matrix. The darkest row has to be black,
+//	idle columns do not draw their dark glyphs again.
+//
+//	Glyphs past the first "columns" continue in bands of ATLAS_LEVELS
+//	rows below, glyph i is in band i / columns. The amount of the
+//	matrix must not go past the glyphs of the atlas.
+//
+typedef struct _GLYPH_ATLAS
+{
+	const uint32_t *pixels;
+	ptrdiff_t stride; // in pixels
+
+	int width;
+	int height;
+
+	int cell_width;
+	int cell_height;
+
+	int columns; // glyphs in a band
+} GLYPH_ATLAS, *PGLYPH_ATLAS;
+
+// top-left pixel of a glyph at its intensity
+static inline const uint32_t *AtlasGlyphPixels (const GLYPH_ATLAS *atlas, GLYPH glyph)
+{
+	int index = GlyphIndex (glyph);
+	int band = index / atlas->columns;
+
+	return atlas->pixels + (((band * ATLAS_LEVELS) + GlyphIntensity (glyph)) * atlas->cell_height * atlas->stride) + ((index - (band * atlas->columns)) * atlas->cell_width);
+}
+
+#define DIRTY_RECTS_MAX 8192
+#define DIRTY_RECTS_DEFAULT 4096
+
+// dirty spans closer than this (in glyphs) are presented as one
+#define DIRTY_SPAN_GAP 2
+
+// pixel rectangle, right and bottom are exclusive
+typedef struct _DIRTY_RECT
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+} DIRTY_RECT, *PDIRTY_RECT;
+
+//
+//	Area changed by the last RenderMatrix call. Dirty glyphs are merged
+//	into column spans, identical spans of neighbouring columns into
+//	rectangles. When more than "limit" rectangles are needed the whole
+//	frame is presented instead.
+//
+typedef struct _DIRTY_REGION
+{
+	int limit;
+	int count;
+
+	bool is_full;
+
+	DIRTY_RECT rect[DIRTY_RECTS_MAX];
+
+	// rectangles reaching the previous and the current column
+	int open[DIRTY_RECTS_MAX];
+	int next_open[DIRTY_RECTS_MAX];
+} DIRTY_REGION, *PDIRTY_REGION;
+
+//
+//	Top-down 32-bit back-buffer covering the whole glyph grid, every
+//	row starts on a cache line.
+//
+typedef struct _FRAMEBUFFER
+{
+	uint32_t *pixels;
+	ptrdiff_t stride; // in pixels
+
+	int width;
+	int height;
+
+	size_t capacity; // in pixels
+
+	DIRTY_REGION dirty;
+} FRAMEBUFFER, *PFRAMEBUFFER;
+
+// room is left for every size the matrix capacity allows
+PFRAMEBUFFER CreateMatrixFramebuffer (PMATRIX matrix);
+
+//
+//	Changes the size of the matrix and its framebuffer. Columns still
+//	in view keep their state and pixels, new ones start empty, so
+//	nothing has to be redrawn. A new cell size keeps the state of the
+//	columns but every glyph in view gets drawn again. Everything stays
+//	in place as long as the capacity allows, otherwise the matrix and
+//	the framebuffer move into one new allocation. Returns the matrix, which may have moved,
+//	or NULL when out of memory and the old matrix is left as it was.
+//
+PMATRIX ResizeMatrix (PMATRIX matrix, int width, int height, int cell_size);
+
+// draw every glyph flagged for redraw into the framebuffer and collect
+// the dirty region, returns the number of glyphs drawn. Nothing gets
+// drawn with an atlas of another cell size.
+size_t RenderMatrix (PMATRIX matrix, const GLYPH_ATLAS *atlas);
+
+//
+//	The two halves of RenderMatrix. Distinct column ranges may be drawn
+//	from different threads, the dirty region is then built once all of
+//	them are done and clears the redraw flags.
+//
+size_t DrawMatrixColumns (PMATRIX matrix, const GLYPH_ATLAS *atlas, int first, int count);
+void BuildDirtyRegion (PMATRIX matrix);
+
+// add a pixel rectangle drawn outside of RenderMatrix
+void AddDirtyRect (PDIRTY_REGION region, int left, int top, int right, int bottom);
+
+void CopyTile (uint32_t *dst, ptrdiff_t dst_stride, const uint32_t *src, ptrdiff_t src_stride, int width, int height);
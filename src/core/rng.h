@@ -0,0 +1,87 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdint.h>
+
+//
+//	xoshiro128** generator, small enough to give every column its own
+//	independent stream. Streams are seeded with splitmix64 from a global
+//	seed and the stream index, so the same seed reproduces every frame.
+//
+typedef struct _RNG_STREAM
+{
+	uint32_t s[4];
+} RNG_STREAM, *PRNG_STREAM;
+
+static inline uint64_t RngSplitMix64 (uint64_t *x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+	return z ^ (z >> 31);
+}
+
+static inline void RngSeed (PRNG_STREAM rng, uint64_t seed, uint64_t stream)
+{
+	uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ull);
+	uint64_t a = RngSplitMix64 (&x);
+	uint64_t b = RngSplitMix64 (&x);
+
+	rng->s[0] = (uint32_t)a;
+	rng->s[1] = (uint32_t)(a >> 32);
+	rng->s[2] = (uint32_t)b;
+	rng->s[3] = (uint32_t)(b >> 32);
+
+	// all zero state would only ever return zeroes
+	if (!(rng->s[0] | rng->s[1] | rng->s[2] | rng->s[3]))
+		rng->s[0] = 1;
+}
+
+static inline uint32_t RngRotl (uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+static inline uint32_t RngNext (PRNG_STREAM rng)
+{
+	uint32_t result = RngRotl (rng->s[1] * 5, 7) * 9;
+	uint32_t t = rng->s[1] << 9;
+
+	rng->s[2] ^= rng->s[0];
+	rng->s[3] ^= rng->s[1];
+	rng->s[1] ^= rng->s[2];
+	rng->s[0] ^= rng->s[3];
+
+	rng->s[2] ^= t;
+	rng->s[3] = RngRotl (rng->s[3], 11);
+
+	return result;
+}
+
+//
+//	Uniform value in [0, range) by multiply-shift (Lemire). The rejection
+//	step removes the bias and is taken with a probability of range / 2^32,
+//	so the modulo inside it practically never runs.
+//
+static inline uint32_t RngRange (PRNG_STREAM rng, uint32_t range)
+{
+	uint64_t m = (uint64_t)RngNext (rng) * range;
+	uint32_t low = (uint32_t)m;
+
+	if (low < range)
+	{
+		uint32_t threshold = (0u - range) % range;
+
+		while (low < threshold)
+		{
+			m = (uint64_t)RngNext (rng) * range;
+			low = (uint32_t)m;
+		}
+	}
+
+	return (uint32_t)(m >> 32);
+}
@@ -0,0 +1,292 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "scale.h"
+#include "cpu.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#endif
+
+// filter weights are fixed point, they add up to one
+#define SCALE_BITS 14
+#define SCALE_ONE (1 << SCALE_BITS)
+
+// a triangle twice as wide as the source pixel needs at most 4 taps
+// per halving, cells are never shrunk to less than a quarter
+#define SCALE_TAPS_MAX 10
+
+typedef struct _SCALE_TAPS
+{
+	int first;
+	int count;
+
+	int16_t weight[SCALE_TAPS_MAX];
+} SCALE_TAPS, *PSCALE_TAPS;
+
+typedef void (*SCALE_ROWS) (uint8_t *dst, const uint8_t *src, ptrdiff_t stride, const SCALE_TAPS *taps, int width);
+
+static inline int FloorInt (double value)
+{
+	int result = (int)value;
+
+	return (value < result) ? result - 1 : result;
+}
+
+static inline int CeilInt (double value)
+{
+	int result = (int)value;
+
+	return (value > result) ? result + 1 : result;
+}
+
+static inline uint8_t ScaleClamp (int32_t value)
+{
+	value >>= SCALE_BITS;
+
+	return (uint8_t)((value < 0) ? 0 : (value > 255) ? 255 : value);
+}
+
+//
+//	Taps of every output pixel along one axis of a cell. Samples past
+//	the cell edge are folded onto the edge pixel, rounding errors go to
+//	the largest tap so the weights always add up to SCALE_ONE.
+//
+static bool ComputeTaps (PSCALE_TAPS taps, int src_size, int dst_size)
+{
+	double weight[SCALE_TAPS_MAX];
+	double scale = (double)dst_size / src_size;
+	double support = (scale < 1.0) ? (1.0 / scale) : 1.0;
+	double center;
+	double distance;
+	double total;
+	int first;
+	int last;
+	int index;
+	int sum;
+	int largest;
+
+	for (int i = 0; i < dst_size; i++)
+	{
+		center = ((i + 0.5) / scale) - 0.5;
+
+		first = FloorInt (center - support) + 1;
+		last = CeilInt (center + support) - 1;
+
+		taps[i].first = (first < 0) ? 0 : first;
+		taps[i].count = ((last >= src_size) ? (src_size - 1) : last) - taps[i].first + 1;
+
+		if (taps[i].count > SCALE_TAPS_MAX)
+			return false;
+
+		for (int j = 0; j < taps[i].count; j++)
+			weight[j] = 0.0;
+
+		total = 0.0;
+
+		for (int j = first; j <= last; j++)
+		{
+			distance = (j - center) / support;
+			distance = 1.0 - ((distance < 0.0) ? -distance : distance);
+
+			if (distance <= 0.0)
+				continue;
+
+			index = ((j < 0) ? 0 : (j >= src_size) ? (src_size - 1) : j) - taps[i].first;
+
+			weight[index] += distance;
+			total += distance;
+		}
+
+		sum = 0;
+		largest = 0;
+
+		for (int j = 0; j < taps[i].count; j++)
+		{
+			taps[i].weight[j] = (int16_t)((weight[j] * SCALE_ONE / total) + 0.5);
+			sum += taps[i].weight[j];
+
+			if (taps[i].weight[j] > taps[i].weight[largest])
+				largest = j;
+		}
+
+		taps[i].weight[largest] += (int16_t)(SCALE_ONE - sum);
+	}
+
+	return true;
+}
+
+static void ScaleRowsScalar (uint8_t *dst, const uint8_t *src, ptrdiff_t stride, const SCALE_TAPS *taps, int width)
+{
+	int32_t sum;
+
+	for (int x = 0; x < width; x++)
+	{
+		sum = SCALE_ONE / 2;
+
+		for (int i = 0; i < taps->count; i++)
+			sum += src[x + (i * stride)] * taps->weight[i];
+
+		dst[x] = ScaleClamp (sum);
+	}
+}
+
+#if defined(CPU_X86)
+
+//
+//	Source rows are taken in pairs, interleaved with their weights a
+//	single multiply-add sums both of them. An odd last row gets paired
+//	with a zero weight.
+//
+CPU_TARGET_SSE2 static void ScaleRowsSse2 (uint8_t *dst, const uint8_t *src, ptrdiff_t stride, const SCALE_TAPS *taps, int width)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i round = _mm_set1_epi32 (SCALE_ONE / 2);
+	__m128i weight[SCALE_TAPS_MAX / 2];
+	__m128i lo;
+	__m128i hi;
+	__m128i a;
+	__m128i b;
+	int pairs = (taps->count + 1) / 2;
+	int x = 0;
+
+	for (int i = 0; i < pairs; i++)
+		weight[i] = _mm_set1_epi32 ((int32_t)(uint16_t)taps->weight[i * 2] | ((2 * i + 1 < taps->count) ? ((int32_t)taps->weight[i * 2 + 1] << 16) : 0));
+
+	for (; x + 8 <= width; x += 8)
+	{
+		lo = round;
+		hi = round;
+
+		for (int i = 0; i < pairs; i++)
+		{
+			a = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(src + x + (i * 2 * stride))), zero);
+			b = (2 * i + 1 < taps->count) ? _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)(src + x + ((i * 2 + 1) * stride))), zero) : zero;
+
+			lo = _mm_add_epi32 (lo, _mm_madd_epi16 (_mm_unpacklo_epi16 (a, b), weight[i]));
+			hi = _mm_add_epi32 (hi, _mm_madd_epi16 (_mm_unpackhi_epi16 (a, b), weight[i]));
+		}
+
+		lo = _mm_packs_epi32 (_mm_srai_epi32 (lo, SCALE_BITS), _mm_srai_epi32 (hi, SCALE_BITS));
+
+		_mm_storel_epi64 ((__m128i *)(dst + x), _mm_packus_epi16 (lo, lo));
+	}
+
+	ScaleRowsScalar (dst + x, src + x, stride, taps, width - x);
+}
+
+CPU_TARGET_AVX2 static void ScaleRowsAvx2 (uint8_t *dst, const uint8_t *src, ptrdiff_t stride, const SCALE_TAPS *taps, int width)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	const __m256i round = _mm256_set1_epi32 (SCALE_ONE / 2);
+	__m256i weight[SCALE_TAPS_MAX / 2];
+	__m256i lo;
+	__m256i hi;
+	__m256i a;
+	__m256i b;
+	int pairs = (taps->count + 1) / 2;
+	int x = 0;
+
+	for (int i = 0; i < pairs; i++)
+		weight[i] = _mm256_set1_epi32 ((int32_t)(uint16_t)taps->weight[i * 2] | ((2 * i + 1 < taps->count) ? ((int32_t)taps->weight[i * 2 + 1] << 16) : 0));
+
+	for (; x + 16 <= width; x += 16)
+	{
+		lo = round;
+		hi = round;
+
+		for (int i = 0; i < pairs; i++)
+		{
+			a = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)(src + x + (i * 2 * stride))));
+			b = (2 * i + 1 < taps->count) ? _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)(src + x + ((i * 2 + 1) * stride)))) : zero;
+
+			// pixels 0-3 and 8-11, 4-7 and 12-15
+			lo = _mm256_add_epi32 (lo, _mm256_madd_epi16 (_mm256_unpacklo_epi16 (a, b), weight[i]));
+			hi = _mm256_add_epi32 (hi, _mm256_madd_epi16 (_mm256_unpackhi_epi16 (a, b), weight[i]));
+		}
+
+		// packing within the lanes puts the pixels back in order
+		lo = _mm256_packs_epi32 (_mm256_srai_epi32 (lo, SCALE_BITS), _mm256_srai_epi32 (hi, SCALE_BITS));
+		lo = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (lo, lo), 0x08);
+
+		_mm_storeu_si128 ((__m128i *)(dst + x), _mm256_castsi256_si128 (lo));
+	}
+
+	ScaleRowsSse2 (dst + x, src + x, stride, taps, width - x);
+}
+
+#endif // CPU_X86
+
+static SCALE_ROWS GetScaleRows (void)
+{
+#if defined(CPU_X86)
+	uint32_t features = CpuGetFeatures ();
+
+	if (features & CPU_FEATURE_AVX2)
+		return &ScaleRowsAvx2;
+
+	if (features & CPU_FEATURE_SSE2)
+		return &ScaleRowsSse2;
+#endif
+
+	return &ScaleRowsScalar;
+}
+
+size_t ScaleCellsTempSize (int columns, int rows, int src_cell_height, int dst_cell_width)
+{
+	return (size_t)columns * dst_cell_width * rows * src_cell_height;
+}
+
+bool ScaleCells (uint8_t *dst, const uint8_t *src, uint8_t *temp, int columns, int rows, int src_cell_width, int src_cell_height, int dst_cell_width, int dst_cell_height)
+{
+	SCALE_TAPS taps_x[SCALE_CELL_MAX];
+	SCALE_TAPS taps_y[SCALE_CELL_MAX];
+	SCALE_ROWS scale_rows;
+	const uint8_t *src_row;
+	uint8_t *temp_row;
+	int src_width = columns * src_cell_width;
+	int dst_width = columns * dst_cell_width;
+	int32_t sum;
+
+	if (columns <= 0 || rows <= 0 || src_cell_width <= 0 || src_cell_height <= 0)
+		return false;
+
+	if (dst_cell_width <= 0 || dst_cell_height <= 0 || dst_cell_width > SCALE_CELL_MAX || dst_cell_height > SCALE_CELL_MAX)
+		return false;
+
+	if (!ComputeTaps (taps_x, src_cell_width, dst_cell_width) || !ComputeTaps (taps_y, src_cell_height, dst_cell_height))
+		return false;
+
+	// horizontal pass into a plane of the final width
+	for (int y = 0; y < rows * src_cell_height; y++)
+	{
+		src_row = src + ((size_t)y * src_width);
+		temp_row = temp + ((size_t)y * dst_width);
+
+		for (int cx = 0; cx < columns; cx++)
+		{
+			for (int x = 0; x < dst_cell_width; x++)
+			{
+				sum = SCALE_ONE / 2;
+
+				for (int i = 0; i < taps_x[x].count; i++)
+					sum += src_row[(cx * src_cell_width) + taps_x[x].first + i] * taps_x[x].weight[i];
+
+				temp_row[(cx * dst_cell_width) + x] = ScaleClamp (sum);
+			}
+		}
+	}
+
+	scale_rows = GetScaleRows ();
+
+	// vertical pass, whole rows at once
+	for (int cy = 0; cy < rows; cy++)
+	{
+		for (int y = 0; y < dst_cell_height; y++)
+		{
+			scale_rows (dst + ((size_t)((cy * dst_cell_height) + y) * dst_width), temp + ((size_t)((cy * src_cell_height) + taps_y[y].first) * dst_width), dst_width, &taps_y[y], dst_width);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,24 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// largest cell edge ScaleCells accepts, in pixels
+#define SCALE_CELL_MAX 128
+
+// temporary memory ScaleCells needs, in bytes
+size_t ScaleCellsTempSize (int columns, int rows, int src_cell_height, int dst_cell_width);
+
+//
+//	Resamples an 8-bit plane made of "columns" by "rows" equally sized
+//	cells, each cell on its own so neighbouring glyphs never bleed into
+//	each other. Triangle filter, widened when shrinking so every source
+//	pixel gets weighted and thin strokes do not drop out. Both planes
+//	are packed, the vertical pass picks the widest simd path the cpu
+//	supports and every path produces identical output.
+//
+bool ScaleCells (uint8_t *dst, const uint8_t *src, uint8_t *temp, int columns, int rows, int src_cell_width, int src_cell_height, int dst_cell_width, int dst_cell_height);
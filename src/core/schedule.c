@@ -0,0 +1,92 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "schedule.h"
+
+void ScheduleInit (PFRAME_SCHEDULE schedule, int64_t now, int64_t period, int max_catchup)
+{
+	if (period < 1)
+		period = 1;
+
+	schedule->period = period;
+	schedule->next = now + period;
+
+	schedule->steps = 0;
+	schedule->dropped = 0;
+
+	ScheduleSetCatchup (schedule, max_catchup);
+}
+
+void ScheduleSetCatchup (PFRAME_SCHEDULE schedule, int max_catchup)
+{
+	if (max_catchup < SCHEDULE_CATCHUP_MIN)
+		max_catchup = SCHEDULE_CATCHUP_MIN;
+
+	if (max_catchup > SCHEDULE_CATCHUP_MAX)
+		max_catchup = SCHEDULE_CATCHUP_MAX;
+
+	schedule->max_catchup = max_catchup;
+}
+
+void ScheduleSetPeriod (PFRAME_SCHEDULE schedule, int64_t period)
+{
+	if (period < 1)
+		period = 1;
+
+	schedule->next += period - schedule->period;
+	schedule->period = period;
+}
+
+int ScheduleAdvance (PFRAME_SCHEDULE schedule, int64_t now)
+{
+	int64_t due;
+
+	if (now < schedule->next)
+		return 0;
+
+	due = ((now - schedule->next) / schedule->period) + 1;
+
+	if (due > schedule->max_catchup)
+	{
+		// too far behind, drop the backlog and restart from now
+		schedule->dropped += (uint64_t)(due - schedule->max_catchup);
+		schedule->next = now + schedule->period;
+
+		due = schedule->max_catchup;
+	}
+	else
+	{
+		schedule->next += due * schedule->period;
+	}
+
+	schedule->steps += (uint64_t)due;
+
+	return (int)due;
+}
+
+int ScheduleResume (PFRAME_SCHEDULE schedule, int64_t now, int max_steps)
+{
+	int64_t due = 0;
+
+	if (max_steps < 0)
+		max_steps = 0;
+
+	if (now >= schedule->next)
+		due = ((now - schedule->next) / schedule->period) + 1;
+
+	if (due > max_steps)
+	{
+		schedule->dropped += (uint64_t)(due - max_steps);
+		due = max_steps;
+	}
+
+	schedule->next = now + schedule->period;
+	schedule->steps += (uint64_t)due;
+
+	return (int)due;
+}
+
+int64_t ScheduleWaitTime (const FRAME_SCHEDULE *schedule, int64_t now)
+{
+	return (schedule->next > now) ? (schedule->next - now) : 0;
+}
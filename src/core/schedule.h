@@ -0,0 +1,51 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stdint.h>
+
+#define SCHEDULE_CATCHUP_MIN 1
+#define SCHEDULE_CATCHUP_MAX 16
+#define SCHEDULE_CATCHUP_DEFAULT 4
+
+//
+//	Fixed timestep scheduler, independent of the clock used. The
+//	simulation always advances in whole steps of "period" ticks, no
+//	matter how often frames get presented. When a frame comes late the
+//	missed steps are run before presenting it (frame-skip), up to
+//	"max_catchup" of them. A larger backlog is dropped, so a stall
+//	never turns into a burst of steps.
+//
+typedef struct _FRAME_SCHEDULE
+{
+	int64_t period; // in clock ticks
+	int64_t next; // due time of the next step
+
+	int max_catchup;
+
+	// statistics
+	uint64_t steps;
+	uint64_t dropped;
+} FRAME_SCHEDULE, *PFRAME_SCHEDULE;
+
+void ScheduleInit (PFRAME_SCHEDULE schedule, int64_t now, int64_t period, int max_catchup);
+
+// keeps the phase, the next step moves by the difference
+void ScheduleSetPeriod (PFRAME_SCHEDULE schedule, int64_t period);
+
+// number of steps due at "now", zero when it is too early
+int ScheduleAdvance (PFRAME_SCHEDULE schedule, int64_t now);
+
+// clamps to the SCHEDULE_CATCHUP range
+void ScheduleSetCatchup (PFRAME_SCHEDULE schedule, int max_catchup);
+
+//
+//	Restarts the schedule after a pause. Returns how many steps were
+//	missed, at most "max_steps", so the caller can fast-forward them
+//	without drawing. The rest is counted as dropped.
+//
+int ScheduleResume (PFRAME_SCHEDULE schedule, int64_t now, int max_steps);
+
+// ticks left until the next step is due
+int64_t ScheduleWaitTime (const FRAME_SCHEDULE *schedule, int64_t now);
@@ -0,0 +1,121 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+void StatsInit (PFRAME_STATS stats, int64_t frequency)
+{
+	memset (stats, 0, sizeof (FRAME_STATS));
+
+	stats->frequency = (frequency > 0) ? frequency : 1;
+}
+
+void StatsAddFrame (PFRAME_STATS stats, const FRAME_SAMPLE *sample)
+{
+	stats->sample[stats->position] = *sample;
+
+	stats->position = (stats->position + 1) % FRAME_STATS_HISTORY;
+
+	if (stats->count < FRAME_STATS_HISTORY)
+		stats->count += 1;
+}
+
+int64_t StatsPercentile (const FRAME_STATS *stats, int percent)
+{
+	int64_t sorted[FRAME_STATS_HISTORY];
+	int64_t value;
+	uint32_t rank;
+	uint32_t j;
+
+	if (!stats->count)
+		return 0;
+
+	// only sorted while the overlay is shown, insertion sort is plenty
+	for (uint32_t i = 0; i < stats->count; i++)
+	{
+		value = stats->sample[i].total;
+
+		for (j = i; j > 0 && sorted[j - 1] > value; j--)
+			sorted[j] = sorted[j - 1];
+
+		sorted[j] = value;
+	}
+
+	rank = ((uint32_t)percent * stats->count + 99) / 100;
+
+	return sorted[(rank > 0) ? (rank - 1) : 0];
+}
+
+void StatsAverage (const FRAME_STATS *stats, PFRAME_SAMPLE average)
+{
+	uint64_t cells = 0;
+	uint64_t blits = 0;
+
+	memset (average, 0, sizeof (FRAME_SAMPLE));
+
+	if (!stats->count)
+		return;
+
+	for (uint32_t i = 0; i < stats->count; i++)
+	{
+		average->total += stats->sample[i].total;
+
+		for (int j = 0; j < FRAME_PHASE_MAX; j++)
+			average->phase[j] += stats->sample[i].phase[j];
+
+		cells += stats->sample[i].cells;
+		blits += stats->sample[i].blits;
+	}
+
+	average->total /= stats->count;
+
+	for (int j = 0; j < FRAME_PHASE_MAX; j++)
+		average->phase[j] /= stats->count;
+
+	average->cells = (uint32_t)(cells / stats->count);
+	average->blits = (uint32_t)(blits / stats->count);
+
+	// a level is not averaged, the last one is what runs now
+	average->quality = stats->sample[(stats->position + FRAME_STATS_HISTORY - 1) % FRAME_STATS_HISTORY].quality;
+}
+
+static double StatsMilliseconds (const FRAME_STATS *stats, int64_t time)
+{
+	return (double)time * 1000.0 / (double)stats->frequency;
+}
+
+size_t StatsFormat (const FRAME_STATS *stats, char *buffer, size_t length)
+{
+	FRAME_SAMPLE average;
+	int result;
+
+	StatsAverage (stats, &average);
+
+	result = snprintf (
+		buffer,
+		length,
+		"FRAME MS P50 %.2f P95 %.2f P99 %.2f\n"
+		"RANDOM %.2f SCROLL %.2f DRAW %.2f\n"
+		"ATLAS %.2f PRESENT %.2f\n"
+		"CELLS %u BLITS %u QUALITY %d",
+		StatsMilliseconds (stats, StatsPercentile (stats, 50)),
+		StatsMilliseconds (stats, StatsPercentile (stats, 95)),
+		StatsMilliseconds (stats, StatsPercentile (stats, 99)),
+		StatsMilliseconds (stats, average.phase[FRAME_PHASE_RANDOM]),
+		StatsMilliseconds (stats, average.phase[FRAME_PHASE_SCROLL]),
+		StatsMilliseconds (stats, average.phase[FRAME_PHASE_DRAW]),
+		StatsMilliseconds (stats, average.phase[FRAME_PHASE_ATLAS]),
+		StatsMilliseconds (stats, average.phase[FRAME_PHASE_PRESENT]),
+		average.cells,
+		average.blits,
+		average.quality
+	);
+
+	if (result < 0)
+		return 0;
+
+	return ((size_t)result < length) ? (size_t)result : (length ? length - 1 : 0);
+}
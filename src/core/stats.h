@@ -0,0 +1,55 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// frames kept for the rolling percentiles
+#define FRAME_STATS_HISTORY 128
+
+typedef enum _FRAME_PHASE
+{
+	FRAME_PHASE_RANDOM,
+	FRAME_PHASE_SCROLL,
+	FRAME_PHASE_DRAW,
+	FRAME_PHASE_ATLAS,
+	FRAME_PHASE_PRESENT,
+	FRAME_PHASE_MAX
+} FRAME_PHASE;
+
+//
+//	Times are in clock ticks. Phases which run on several threads
+//	add up the time of every thread, so they may exceed the total.
+//
+typedef struct _FRAME_SAMPLE
+{
+	int64_t total;
+	int64_t phase[FRAME_PHASE_MAX];
+
+	uint32_t cells; // glyphs drawn
+	uint32_t blits; // rectangles presented
+
+	int quality; // governor level the frame ran at
+} FRAME_SAMPLE, *PFRAME_SAMPLE;
+
+typedef struct _FRAME_STATS
+{
+	int64_t frequency; // clock ticks per second
+
+	uint32_t count;
+	uint32_t position;
+
+	FRAME_SAMPLE sample[FRAME_STATS_HISTORY];
+} FRAME_STATS, *PFRAME_STATS;
+
+void StatsInit (PFRAME_STATS stats, int64_t frequency);
+void StatsAddFrame (PFRAME_STATS stats, const FRAME_SAMPLE *sample);
+
+// frame time below which "percent" of the recent frames are, nearest rank
+int64_t StatsPercentile (const FRAME_STATS *stats, int percent);
+void StatsAverage (const FRAME_STATS *stats, PFRAME_SAMPLE average);
+
+// multi-line summary for the overlay, returns the length written
+size_t StatsFormat (const FRAME_STATS *stats, char *buffer, size_t length);
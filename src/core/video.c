@@ -0,0 +1,189 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include <stdio.h>
+#include <string.h>
+
+#include "video.h"
+
+#define Y4M_FRAME_TAG "FRAME\n"
+
+size_t VideoFrameSize (VIDEO_FORMAT format, int width, int height)
+{
+	(void)format;
+
+	// both formats use three bytes per pixel
+	return (size_t)width * height * 3;
+}
+
+static bool VideoWrite (PVIDEO_WRITER writer, const void *data, size_t size)
+{
+	if (writer->is_failed)
+		return false;
+
+	writer->bytes += size;
+
+	if (writer->length + size > writer->capacity)
+	{
+		if (!VideoFlush (writer))
+			return false;
+
+		// too large for the buffer, no point in copying it
+		if (size >= writer->capacity)
+		{
+			if (!writer->sink (writer->context, data, size))
+				writer->is_failed = true;
+
+			return !writer->is_failed;
+		}
+	}
+
+	memcpy (writer->buffer + writer->length, data, size);
+	writer->length += size;
+
+	return true;
+}
+
+bool VideoFlush (PVIDEO_WRITER writer)
+{
+	if (writer->is_failed)
+		return false;
+
+	if (writer->length && !writer->sink (writer->context, writer->buffer, writer->length))
+		writer->is_failed = true;
+
+	writer->length = 0;
+
+	return !writer->is_failed;
+}
+
+bool VideoInit (PVIDEO_WRITER writer, VIDEO_FORMAT format, int width, int height, int fps_num, int fps_den, uint8_t *frame, uint8_t *buffer, size_t capacity, VIDEO_SINK sink, void *context)
+{
+	char header[128];
+	int length;
+
+	memset (writer, 0, sizeof (VIDEO_WRITER));
+
+	if (width <= 0 || height <= 0 || fps_num <= 0 || fps_den <= 0 || !frame || !buffer || !capacity || !sink)
+		return false;
+
+	writer->sink = sink;
+	writer->context = context;
+	writer->format = format;
+	writer->width = width;
+	writer->height = height;
+	writer->frame = frame;
+	writer->buffer = buffer;
+	writer->capacity = capacity;
+
+	if (format != VIDEO_FORMAT_Y4M)
+		return true;
+
+	length = snprintf (header, sizeof (header), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444 XCOLORRANGE=LIMITED\n", width, height, fps_num, fps_den);
+
+	return VideoWrite (writer, header, (size_t)length);
+}
+
+//
+//	Framebuffer pixels use the 32-bit dib layout, 0x00RRGGBB. Luma and
+//	chroma are the usual 8-bit fixed point bt.601 studio swing formulas.
+//
+static void ConvertY4m (PVIDEO_WRITER writer, const FRAMEBUFFER *framebuffer, const DIRTY_RECT *rect)
+{
+	size_t plane = (size_t)writer->width * writer->height;
+	const uint32_t *src;
+	uint8_t *y_plane;
+	uint8_t *u_plane;
+	uint8_t *v_plane;
+	int r, g, b;
+
+	for (int y = rect->top; y < rect->bottom; y++)
+	{
+		src = framebuffer->pixels + (y * framebuffer->stride);
+
+		y_plane = writer->frame + ((size_t)y * writer->width);
+		u_plane = y_plane + plane;
+		v_plane = u_plane + plane;
+
+		for (int x = rect->left; x < rect->right; x++)
+		{
+			r = (src[x] >> 16) & 0xFF;
+			g = (src[x] >> 8) & 0xFF;
+			b = src[x] & 0xFF;
+
+			y_plane[x] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			u_plane[x] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			v_plane[x] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+}
+
+static void ConvertRgb24 (PVIDEO_WRITER writer, const FRAMEBUFFER *framebuffer, const DIRTY_RECT *rect)
+{
+	const uint32_t *src;
+	uint8_t *dst;
+
+	for (int y = rect->top; y < rect->bottom; y++)
+	{
+		src = framebuffer->pixels + (y * framebuffer->stride);
+		dst = writer->frame + (((size_t)y * writer->width) * 3);
+
+		for (int x = rect->left; x < rect->right; x++)
+		{
+			dst[x * 3 + 0] = (uint8_t)(src[x] >> 16);
+			dst[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+			dst[x * 3 + 2] = (uint8_t)src[x];
+		}
+	}
+}
+
+static void ConvertRect (PVIDEO_WRITER writer, const FRAMEBUFFER *framebuffer, DIRTY_RECT rect)
+{
+	// the framebuffer covers whole glyphs, the video only the screen
+	if (rect.right > writer->width)
+		rect.right = writer->width;
+
+	if (rect.bottom > writer->height)
+		rect.bottom = writer->height;
+
+	if (rect.left >= rect.right || rect.top >= rect.bottom)
+		return;
+
+	if (writer->format == VIDEO_FORMAT_Y4M)
+	{
+		ConvertY4m (writer, framebuffer, &rect);
+	}
+	else
+	{
+		ConvertRgb24 (writer, framebuffer, &rect);
+	}
+}
+
+bool VideoWriteFrame (PVIDEO_WRITER writer, const FRAMEBUFFER *framebuffer)
+{
+	const DIRTY_REGION *dirty = &framebuffer->dirty;
+	DIRTY_RECT full = {0, 0, writer->width, writer->height};
+
+	if (writer->is_failed)
+		return false;
+
+	if (framebuffer->width < writer->width || framebuffer->height < writer->height)
+		return false;
+
+	if (!writer->frames || dirty->is_full)
+	{
+		ConvertRect (writer, framebuffer, full);
+	}
+	else
+	{
+		for (int i = 0; i < dirty->count; i++)
+			ConvertRect (writer, framebuffer, dirty->rect[i]);
+	}
+
+	writer->frames += 1;
+
+	if (writer->format == VIDEO_FORMAT_Y4M && !VideoWrite (writer, Y4M_FRAME_TAG, sizeof (Y4M_FRAME_TAG) - 1))
+		return false;
+
+	return VideoWrite (writer, writer->frame, VideoFrameSize (writer->format, writer->width, writer->height));
+}
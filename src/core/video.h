@@ -0,0 +1,56 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include "render.h"
+
+// output buffer of the offline renderer, written out in one piece
+#define VIDEO_BUFFER_DEFAULT (4 * 1024 * 1024)
+
+typedef enum _VIDEO_FORMAT
+{
+	VIDEO_FORMAT_Y4M, // yuv4mpeg2, planar 4:4:4 bt.601 limited range
+	VIDEO_FORMAT_RGB24, // headerless packed rgb
+} VIDEO_FORMAT;
+
+// writes "size" bytes, returns false on error
+typedef bool (*VIDEO_SINK) (void *context, const void *data, size_t size);
+
+//
+//	Streams framebuffer contents as video. The converted frame is kept
+//	between calls and only the dirty region of the framebuffer gets
+//	converted again, then the whole frame goes through the output
+//	buffer. Both memory blocks are owned by the caller.
+//
+typedef struct _VIDEO_WRITER
+{
+	VIDEO_SINK sink;
+	void *context;
+
+	VIDEO_FORMAT format;
+
+	int width;
+	int height;
+
+	uint8_t *frame; // VideoFrameSize bytes
+	uint8_t *buffer;
+
+	size_t capacity;
+	size_t length;
+
+	uint64_t frames;
+	uint64_t bytes;
+
+	bool is_failed;
+} VIDEO_WRITER, *PVIDEO_WRITER;
+
+size_t VideoFrameSize (VIDEO_FORMAT format, int width, int height);
+
+// writes the stream header, the frame rate is fps_num / fps_den
+bool VideoInit (PVIDEO_WRITER writer, VIDEO_FORMAT format, int width, int height, int fps_num, int fps_den, uint8_t *frame, uint8_t *buffer, size_t capacity, VIDEO_SINK sink, void *context);
+
+// call after RenderMatrix, the first frame is converted in full
+bool VideoWriteFrame (PVIDEO_WRITER writer, const FRAMEBUFFER *framebuffer);
+
+bool VideoFlush (PVIDEO_WRITER writer);
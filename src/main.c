@@ -10,399 +10,1956 @@
 #include "resource.h"
 
 STATIC_DATA config;
+ATLAS_CACHE atlas_cache;
+STARTUP_TRACE startup;
+PWORKER_POOL workers;
+
+// GUID_CONSOLE_DISPLAY_STATE, defined here to not depend on initguid
+static const GUID display_state_guid = {0x6FE69556, 0x704A, 0x47A0, {0x8F, 0x24, 0xC2, 0x8D, 0x93, 0x6F, 0xDA, 0x47}};
 
 #define RND_MAX INT_MAX
 
 VOID ReadSettings ()
 {
+	PR_STRING font;
+
 	config.speed = _r_config_getinteger (L"Speed", SPEED_DEFAULT);
 	config.amount = _r_config_getinteger (L"NumGlyphs", AMOUNT_DEFAULT);
 	config.density = _r_config_getinteger (L"Density", DENSITY_DEFAULT);
 	config.hue = _r_config_getinteger (L"Hue", HUE_DEFAULT);
+	config.max_dirty_rects = _r_config_getinteger (L"MaxDirtyRects", DIRTY_RECTS_DEFAULT);
+	config.seed = _r_config_getinteger (L"Seed", 0);
+	config.threads = _r_config_getinteger (L"Threads", WORKERS_DEFAULT);
+	config.max_catchup = _r_config_getinteger (L"MaxCatchUp", SCHEDULE_CATCHUP_DEFAULT);
+	config.battery_fps = _r_config_getinteger (L"BatteryFps", BATTERY_FPS_DEFAULT);
+	config.cell_size = _r_config_getinteger (L"CellSize", 0);
+	config.quality = _r_config_getinteger (L"Quality", QUALITY_DEFAULT);
+	config.quality_floor = _r_config_getinteger (L"QualityFloor", QUALITY_FLOOR_DEFAULT);
+	config.phosphor = _r_config_getinteger (L"Phosphor", PHOSPHOR_DEFAULT);
+	config.font_first = _r_config_getinteger (L"FontFirst", FONT_FIRST_DEFAULT);
+	config.font_last = _r_config_getinteger (L"FontLast", FONT_LAST_DEFAULT);
+
+	font = _r_config_getstring (L"Font", NULL);
+
+	if (font)
+	{
+		_r_str_copy (config.font, RTL_NUMBER_OF (config.font), font->buffer);
+		_r_obj_dereference (font);
+	}
+
+	config.is_esc_only = _r_config_getboolean (L"IsEscOnly", FALSE);
+
+	config.is_random = _r_config_getboolean (L"Random", HUE_RANDOM);
+	config.is_smooth = _r_config_getboolean (L"RandomSmoothTransition", HUE_RANDOM_SMOOTHTRANSITION);
+
+	config.is_vsync = _r_config_getboolean (L"VSync", FALSE);
+	config.is_stats = _r_config_getboolean (L"ShowStats", FALSE);
+	config.is_prewarm = _r_config_getboolean (L"Prewarm", TRUE);
+}
+
+VOID SaveSettings ()
+{
+	_r_config_setinteger (L"Speed", config.speed);
+	_r_config_setinteger (L"NumGlyphs", config.amount);
+	_r_config_setinteger (L"Density", config.density);
+	_r_config_setinteger (L"Hue", config.hue);
+	_r_config_setinteger (L"MaxDirtyRects", config.max_dirty_rects);
+	_r_config_setinteger (L"Seed", config.seed);
+	_r_config_setinteger (L"Threads", config.threads);
+	_r_config_setinteger (L"MaxCatchUp", config.max_catchup);
+	_r_config_setinteger (L"BatteryFps", config.battery_fps);
+	_r_config_setinteger (L"CellSize", config.cell_size);
+	_r_config_setinteger (L"Quality", config.quality);
+	_r_config_setinteger (L"QualityFloor", config.quality_floor);
+	_r_config_setinteger (L"Phosphor", config.phosphor);
+	_r_config_setinteger (L"FontFirst", config.font_first);
+	_r_config_setinteger (L"FontLast", config.font_last);
+	_r_config_setstring (L"Font", config.font);
+
+	_r_config_setboolean (L"IsEscOnly", config.is_esc_only);
+
+	_r_config_setboolean (L"Random", config.is_random);
+	_r_config_setboolean (L"RandomSmoothTransition", config.is_smooth);
+
+	_r_config_setboolean (L"VSync", config.is_vsync);
+	_r_config_setboolean (L"ShowStats", config.is_stats);
+	_r_config_setboolean (L"Prewarm", config.is_prewarm);
+}
+
+PVOID MatrixAllocate (PVOID context, SIZE_T size)
+{
+	return _r_mem_allocatezero (size);
+}
+
+VOID MatrixFree (PVOID context, PVOID ptr)
+{
+	_r_mem_free (ptr);
+}
+
+UINT32 MatrixRandom (PVOID context)
+{
+	return _r_math_rand (0, RND_MAX);
+}
+
+//
+// the atlas baked at build time, it stays in the mapped image so
+// nothing is copied until the planes are needed.
+//
+BOOLEAN LoadAtlasImage ()
+{
+	HINSTANCE hinst = _r_sys_getimagebase ();
+	HGLOBAL hdata;
+	HRSRC hres;
+	PVOID data;
+
+	if (atlas_cache.image.pixels)
+		return TRUE;
+
+	hres = FindResource (hinst, MAKEINTRESOURCE (IDR_ATLAS), RT_RCDATA);
+
+	if (!hres)
+		return FALSE;
+
+	hdata = LoadResource (hinst, hres);
+
+	if (!hdata)
+		return FALSE;
+
+	data = LockResource (hdata);
+
+	// the source planes of the bitmap, scaled for other sizes
+	if (!data || !ReadAtlasImage (data, SizeofResource (hinst, hres), &atlas_cache.image) || atlas_cache.image.cell_width != GLYPH_WIDTH)
+	{
+		RtlSecureZeroMemory (&atlas_cache.image, sizeof (atlas_cache.image));
+		return FALSE;
+	}
+
+	atlas_cache.columns = atlas_cache.image.columns;
+	atlas_cache.rows = atlas_cache.image.rows;
+
+	return TRUE;
+}
+
+BOOLEAN LoadAtlasSource (HDC hdc)
+{
+	DIBSECTION dib = {0};
+	RGBQUAD pal[256] = {0};
+	BYTE pal_saturation[256];
+	BYTE pal_luminance[256];
+	PATLAS_PLANES planes;
+	HANDLE hbitmap_old;
+	HBITMAP hglyph;
+	PBYTE src;
+	HDC hdc_c;
+	LONG height;
+	LONG width;
+	LONG count;
+
+	if (atlas_cache.planes_count)
+		return TRUE;
+
+	// the baked planes need no decoding
+	if (LoadAtlasImage ())
+	{
+		count = atlas_cache.columns * GLYPH_WIDTH * atlas_cache.rows * GLYPH_HEIGHT;
+
+		planes = &atlas_cache.planes[0];
+
+		planes->saturation = _r_mem_allocatezero (count * 2);
+
+		if (planes->saturation)
+		{
+			planes->luminance = planes->saturation + count;
+			planes->cell_size = GLYPH_WIDTH;
+
+			RtlCopyMemory (planes->saturation, atlas_cache.image.saturation, count);
+			RtlCopyMemory (planes->luminance, atlas_cache.image.luminance, count);
+
+			atlas_cache.planes_count = 1;
+
+			return TRUE;
+		}
+	}
+
+	// load the 8bit image
+	hglyph = LoadImage (_r_sys_getimagebase (), MAKEINTRESOURCE (IDR_GLYPH), IMAGE_BITMAP, 0, 0, LR_CREATEDIBSECTION);
+
+	if (!hglyph)
+		return FALSE;
+
+	// extract the colour table
+	hdc_c = CreateCompatibleDC (hdc);
+	hbitmap_old = SelectObject (hdc_c, hglyph);
+	GetDIBColorTable (hdc_c, 0, RTL_NUMBER_OF (pal), pal);
+	SelectObject (hdc_c, hbitmap_old);
+	DeleteDC (hdc_c);
+
+	GetObject (hglyph, sizeof (dib), &dib);
+
+	// partial glyphs at the right or bottom edge are never drawn
+	atlas_cache.columns = dib.dsBmih.biWidth / GLYPH_WIDTH;
+	atlas_cache.rows = abs (dib.dsBmih.biHeight) / GLYPH_HEIGHT;
+
+	width = atlas_cache.columns * GLYPH_WIDTH;
+	height = atlas_cache.rows * GLYPH_HEIGHT;
+	count = width * height;
+
+	if (!count)
+	{
+		DeleteObject (hglyph);
+		return FALSE;
+	}
+
+	// recoloring keeps saturation and luminance, so convert the
+	// palette once and only store those two values for every pixel
+	for (SIZE_T i = 0; i < RTL_NUMBER_OF (pal); i++)
+	{
+		WORD h, l, s;
+
+		RgbToHls (RGB (pal[i].rgbRed, pal[i].rgbGreen, pal[i].rgbBlue), &h, &l, &s);
+
+		pal_saturation[i] = (BYTE)s;
+		pal_luminance[i] = (BYTE)l;
+	}
+
+	planes = &atlas_cache.planes[0];
+
+	planes->saturation = _r_mem_allocatezero (count * 2);
+
+	if (!planes->saturation)
+	{
+		DeleteObject (hglyph);
+		return FALSE;
+	}
+
+	planes->luminance = planes->saturation + count;
+	planes->cell_size = GLYPH_WIDTH;
+
+	for (LONG y = 0; y < height; y++)
+	{
+		// positive height means a bottom-up bitmap, the planes are top-down
+		src = (PBYTE)dib.dsBm.bmBits + (SIZE_T)dib.dsBm.bmWidthBytes * ((dib.dsBmih.biHeight > 0) ? (dib.dsBmih.biHeight - 1 - y) : y);
+
+		for (LONG x = 0; x < width; x++)
+		{
+			planes->saturation[y * width + x] = pal_saturation[src[x]];
+			planes->luminance[y * width + x] = pal_luminance[src[x]];
+		}
+	}
+
+	atlas_cache.planes_count = 1;
+
+	DeleteObject (hglyph);
+
+	return TRUE;
+}
+
+//
+// glyphs of the font and the character range from the settings. they
+// get the tones of the baked atlas, so every intensity looks the same
+// as with the bitmap.
+//
+BOOLEAN LoadFontSource ()
+{
+	WCHAR path[MAX_PATH];
+	ULONG length;
+	INT count;
+
+	if (atlas_cache.is_font)
+		return TRUE;
+
+	if (!config.font[0] || config.font_first < 0x20 || config.font_last < config.font_first || config.font_last > 0xFFFF)
+		return FALSE;
+
+	if (!LoadAtlasImage ())
+		return FALSE;
+
+	length = GetEnvironmentVariable (L"LOCALAPPDATA", path, RTL_NUMBER_OF (path));
+
+	if (!length || length >= RTL_NUMBER_OF (path))
+		length = GetTempPath (RTL_NUMBER_OF (path), path);
+
+	if (!length || length >= RTL_NUMBER_OF (path))
+		return FALSE;
+
+	if (swprintf_s (atlas_cache.cache_path, RTL_NUMBER_OF (atlas_cache.cache_path), L"%s\\" APP_NAME_SHORT, path) < 0)
+		return FALSE;
+
+	// already there most of the time
+	CreateDirectory (atlas_cache.cache_path, NULL);
+
+	count = config.font_last - config.font_first + 1;
+
+	if (count > GLYPHS_MAX)
+		count = GLYPHS_MAX;
+
+	MeasureAtlasTones (atlas_cache.tone, atlas_cache.image.saturation, atlas_cache.image.luminance, atlas_cache.image.columns, atlas_cache.image.cell_width, atlas_cache.image.cell_height);
+
+	atlas_cache.font_glyphs = count;
+	atlas_cache.columns = (count < FONT_ATLAS_COLUMNS) ? count : FONT_ATLAS_COLUMNS;
+	atlas_cache.rows = AtlasGlyphRows (count, atlas_cache.columns);
+
+	// new tones or a new layout make new files
+	atlas_cache.font_key = AtlasKeyUpdate (ATLAS_KEY_INIT, config.font, wcslen (config.font) * sizeof (WCHAR));
+	atlas_cache.font_key = AtlasKeyUpdate (atlas_cache.font_key, &config.font_first, sizeof (config.font_first));
+	atlas_cache.font_key = AtlasKeyUpdate (atlas_cache.font_key, &count, sizeof (count));
+	atlas_cache.font_key = AtlasKeyUpdate (atlas_cache.font_key, &atlas_cache.columns, sizeof (atlas_cache.columns));
+	atlas_cache.font_key = AtlasKeyUpdate (atlas_cache.font_key, atlas_cache.tone, sizeof (atlas_cache.tone));
+
+	atlas_cache.is_font = TRUE;
+
+	return TRUE;
+}
+
+UINT64 GetFontAtlasKey (INT hue, INT cell_size)
+{
+	UINT64 key = atlas_cache.font_key;
+
+	key = AtlasKeyUpdate (key, &hue, sizeof (hue));
+	key = AtlasKeyUpdate (key, &cell_size, sizeof (cell_size));
+
+	return key;
+}
+
+BOOLEAN GetAtlasCachePath (UINT64 key, LPWSTR path, SIZE_T length)
+{
+	return swprintf_s (path, length, L"%s\\%016llx.atlas", atlas_cache.cache_path, key) > 0;
+}
+
+//
+// maps the cache file of a font atlas read-only, the pixels are used as
+// they are. returns the view, files of another key or layout are stale.
+//
+PVOID MapAtlasCache (INT hue, INT cell_size, PATLAS_IMAGE image)
+{
+	WCHAR path[MAX_PATH];
+	LARGE_INTEGER size = {0};
+	HANDLE hfile;
+	HANDLE hmap;
+	PVOID view = NULL;
+	UINT64 key = GetFontAtlasKey (hue, cell_size);
+
+	if (!GetAtlasCachePath (key, path, RTL_NUMBER_OF (path)))
+		return NULL;
+
+	hfile = CreateFile (path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hfile == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (GetFileSizeEx (hfile, &size) && size.QuadPart > 0 && (ULONG64)size.QuadPart <= SIZE_MAX)
+	{
+		hmap = CreateFileMapping (hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		// the view keeps the mapping alive
+		if (hmap)
+		{
+			view = MapViewOfFile (hmap, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle (hmap);
+		}
+	}
+
+	CloseHandle (hfile);
+
+	if (!view)
+		return NULL;
+
+	if (!ReadAtlasImage (view, (SIZE_T)size.QuadPart, image) || image->key != key || image->hue != hue || image->cell_width != cell_size || image->columns != atlas_cache.columns || image->rows != atlas_cache.rows)
+	{
+		UnmapViewOfFile (view);
+		return NULL;
+	}
+
+	return view;
+}
+
+// writes "size" bytes in as many calls as it takes
+BOOLEAN WriteAtlasPart (HANDLE hfile, LPCVOID data, SIZE_T size)
+{
+	ULONG written;
+	ULONG length;
+
+	while (size)
+	{
+		length = (size > MAXDWORD) ? MAXDWORD : (ULONG)size;
+
+		if (!WriteFile (hfile, data, length, &written, NULL) || !written)
+			return FALSE;
+
+		data = (const BYTE *)data + written;
+		size -= written;
+	}
+
+	return TRUE;
+}
+
+//
+// writes a font atlas for the next start. the file is written under a
+// name of its own and then moved in place, so other processes never map
+// half of it. failures only cost the next start the rasterization. it
+// runs without the atlas lock, the planes are pinned and the atlas is
+// referenced by the caller, so neither of them can change meanwhile.
+//
+VOID SaveAtlasCache (INT hue, INT cell_size, PATLAS_PLANES planes, const ULONG *bits)
+{
+	WCHAR temp_path[MAX_PATH];
+	WCHAR path[MAX_PATH];
+	ATLAS_IMAGE_HEADER header;
+	ATLAS_IMAGE image = {0};
+	HANDLE hfile;
+	SIZE_T count;
+	BOOLEAN is_written;
+
+	image.saturation = planes->saturation;
+	image.luminance = planes->luminance;
+	image.pixels = bits;
+
+	image.key = GetFontAtlasKey (hue, cell_size);
+
+	image.columns = atlas_cache.columns;
+	image.rows = atlas_cache.rows;
+	image.cell_width = cell_size;
+	image.cell_height = cell_size;
+	image.hue = hue;
+
+	if (!GetAtlasCachePath (image.key, path, RTL_NUMBER_OF (path)))
+		return;
+
+	// render threads of other monitors may write the same file
+	if (swprintf_s (temp_path, RTL_NUMBER_OF (temp_path), L"%s.%lu.%lu", path, GetCurrentProcessId (), GetCurrentThreadId ()) < 0)
+		return;
+
+	count = (SIZE_T)image.columns * cell_size * image.rows * cell_size;
+
+	BakeAtlasHeader (&header, &image);
+
+	hfile = CreateFile (temp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hfile == INVALID_HANDLE_VALUE)
+		return;
+
+	// the same layout BakeAtlasImage puts into memory
+	is_written = WriteAtlasPart (hfile, &header, sizeof (header)) &&
+		WriteAtlasPart (hfile, planes->saturation, count) &&
+		WriteAtlasPart (hfile, planes->luminance, count) &&
+		WriteAtlasPart (hfile, bits, count * sizeof (ULONG));
+
+	CloseHandle (hfile);
+
+	if (!is_written || !MoveFileEx (temp_path, path, MOVEFILE_REPLACE_EXISTING))
+		DeleteFile (temp_path);
+}
+
+//
+// every glyph of the range is drawn white on black with grayscale
+// antialiasing, the coverage is then shaded into all the intensities.
+//
+BOOLEAN RasterizeFontPlanes (HDC hdc, INT cell_size, PATLAS_PLANES planes)
+{
+	BITMAPINFO bmi = {0};
+	HBITMAP hbitmap = NULL;
+	HANDLE hbitmap_old;
+	HANDLE hfont_old;
+	HFONT hfont = NULL;
+	HDC hdc_c = NULL;
+	PBYTE coverage;
+	PULONG bits = NULL;
+	RECT rect;
+	WCHAR ch;
+	SIZE_T size = (SIZE_T)cell_size * cell_size;
+	BOOLEAN is_success = FALSE;
+
+	coverage = _r_mem_allocatezero (atlas_cache.font_glyphs * size);
+
+	if (!coverage)
+		return FALSE;
+
+	bmi.bmiHeader.biSize = sizeof (BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = cell_size;
+	bmi.bmiHeader.biHeight = -cell_size; // top-down
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	hdc_c = CreateCompatibleDC (hdc);
+
+	if (hdc_c)
+		hbitmap = CreateDIBSection (hdc_c, &bmi, DIB_RGB_COLORS, (PVOID *)&bits, NULL, 0);
+
+	// the em box fills the cell, like the glyphs of the bitmap
+	hfont = CreateFont (-cell_size, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_TT_PRECIS, CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY, DEFAULT_PITCH, config.font);
+
+	if (hdc_c && hbitmap && bits && hfont)
+	{
+		hbitmap_old = SelectObject (hdc_c, hbitmap);
+		hfont_old = SelectObject (hdc_c, hfont);
+
+		SetBkMode (hdc_c, TRANSPARENT);
+		SetTextColor (hdc_c, RGB (255, 255, 255));
+
+		SetRect (&rect, 0, 0, cell_size, cell_size);
+
+		for (INT i = 0; i < atlas_cache.font_glyphs; i++)
+		{
+			ch = (WCHAR)(config.font_first + i);
+
+			RtlZeroMemory (bits, size * sizeof (ULONG));
+
+			DrawText (hdc_c, &ch, 1, &rect, DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX | DT_NOCLIP);
+
+			// gdi batches its drawing
+			GdiFlush ();
+
+			// grayscale, every channel holds the coverage
+			for (SIZE_T j = 0; j < size; j++)
+				coverage[(i * size) + j] = (BYTE)(bits[j] >> 8);
+		}
+
+		SelectObject (hdc_c, hfont_old);
+		SelectObject (hdc_c, hbitmap_old);
+
+		ShadeGlyphCoverage (planes->saturation, planes->luminance, coverage, atlas_cache.font_glyphs, atlas_cache.columns, cell_size, cell_size, atlas_cache.tone);
+
+		is_success = TRUE;
+	}
+
+	if (hfont)
+		DeleteObject (hfont);
+
+	if (hbitmap)
+		DeleteObject (hbitmap);
+
+	if (hdc_c)
+		DeleteDC (hdc_c);
+
+	_r_mem_free (coverage);
+
+	return is_success;
+}
+
+// planes of a font atlas, from its cache file when there is one
+BOOLEAN LoadFontPlanes (HDC hdc, INT cell_size, PATLAS_PLANES planes)
+{
+	ATLAS_IMAGE image;
+	PVOID view;
+	SIZE_T count;
+
+	// every hue has the same planes, the configured one is most likely
+	view = MapAtlasCache (config.hue % HLS_MAX, cell_size, &image);
+
+	if (view)
+	{
+		count = (SIZE_T)atlas_cache.columns * cell_size * atlas_cache.rows * cell_size;
+
+		RtlCopyMemory (planes->saturation, image.saturation, count);
+		RtlCopyMemory (planes->luminance, image.luminance, count);
+
+		UnmapViewOfFile (view);
+
+		return TRUE;
+	}
+
+	return RasterizeFontPlanes (hdc, cell_size, planes);
+}
+
+//
+// frees the least recently used scaled planes until "size" more bytes
+// fit ATLAS_PLANES_BYTES, the freed slots are empty then.
+//
+VOID TrimAtlasPlanes (SIZE_T size)
+{
+	PATLAS_PLANES planes;
+	PATLAS_PLANES victim;
+	SIZE_T total;
+	INT first = atlas_cache.is_font ? 0 : 1;
+
+	while (TRUE)
+	{
+		total = size;
+		victim = NULL;
+
+		for (INT i = 0; i < atlas_cache.planes_count; i++)
+		{
+			planes = &atlas_cache.planes[i];
+
+			if (!planes->saturation)
+				continue;
+
+			total += (SIZE_T)atlas_cache.columns * planes->cell_size * atlas_cache.rows * planes->cell_size * 2;
+
+			if (i >= first && !planes->ref_count && (!victim || planes->last_used < victim->last_used))
+				victim = planes;
+		}
+
+		if (total <= ATLAS_PLANES_BYTES || !victim)
+			break;
+
+		_r_mem_free (victim->saturation);
+
+		victim->saturation = NULL;
+		victim->luminance = NULL;
+		victim->cell_size = 0;
+		victim->last_used = 0;
+	}
+}
+
+//
+// glyph planes at a cell size, scaled from the source the first time
+// the size is used. an empty slot is taken first, when all slots are
+// taken the least recently used scaled planes make room, the source
+// planes always stay. font glyphs are rasterized at the size instead,
+// there are no source planes then.
+//
+PATLAS_PLANES GetAtlasPlanes (HDC hdc, INT cell_size)
+{
+	PATLAS_PLANES planes = NULL;
+	PATLAS_PLANES source;
+	PBYTE temp;
+	SIZE_T count;
+	INT first = atlas_cache.is_font ? 0 : 1;
+	BOOLEAN is_new = FALSE;
+
+	for (INT i = 0; i < atlas_cache.planes_count; i++)
+	{
+		if (atlas_cache.planes[i].cell_size == cell_size)
+		{
+			planes = &atlas_cache.planes[i];
+			planes->last_used = atlas_cache.clock;
+
+			return planes;
+		}
+	}
+
+	count = (SIZE_T)atlas_cache.columns * cell_size * atlas_cache.rows * cell_size;
+
+	TrimAtlasPlanes (count * 2);
+
+	for (INT i = first; i < atlas_cache.planes_count; i++)
+	{
+		if (!atlas_cache.planes[i].cell_size)
+		{
+			planes = &atlas_cache.planes[i];
+			break;
+		}
+
+		if (!atlas_cache.planes[i].ref_count && (!planes || atlas_cache.planes[i].last_used < planes->last_used))
+			planes = &atlas_cache.planes[i];
+	}
+
+	if ((!planes || planes->cell_size) && atlas_cache.planes_count < ATLAS_PLANES_MAX)
+	{
+		planes = &atlas_cache.planes[atlas_cache.planes_count];
+
+		atlas_cache.planes_count += 1;
+
+		is_new = TRUE;
+	}
+
+	if (!planes)
+		return NULL;
+
+	if (planes->saturation)
+		_r_mem_free (planes->saturation);
+
+	source = &atlas_cache.planes[0];
+
+	planes->saturation = _r_mem_allocatezero (count * 2);
+	planes->luminance = NULL;
+	planes->cell_size = 0;
+	planes->last_used = 0;
+
+	// nothing to give back
+	if (!planes->saturation)
+	{
+		if (is_new)
+			atlas_cache.planes_count -= 1;
+
+		return NULL;
+	}
+
+	planes->luminance = planes->saturation + count;
+
+	if (atlas_cache.is_font)
+	{
+		if (LoadFontPlanes (hdc, cell_size, planes))
+		{
+			planes->cell_size = cell_size;
+			planes->last_used = atlas_cache.clock;
+		}
+	}
+	else
+	{
+		temp = _r_mem_allocatezero (ScaleCellsTempSize (atlas_cache.columns, atlas_cache.rows, GLYPH_HEIGHT, cell_size));
+
+		if (temp)
+		{
+			if (ScaleCells (planes->saturation, source->saturation, temp, atlas_cache.columns, atlas_cache.rows, GLYPH_WIDTH, GLYPH_HEIGHT, cell_size, cell_size) &&
+				ScaleCells (planes->luminance, source->luminance, temp, atlas_cache.columns, atlas_cache.rows, GLYPH_WIDTH, GLYPH_HEIGHT, cell_size, cell_size))
+			{
+				planes->cell_size = cell_size;
+				planes->last_used = atlas_cache.clock;
+			}
+
+			_r_mem_free (temp);
+		}
+	}
+
+	if (planes->cell_size)
+		return planes;
+
+	_r_mem_free (planes->saturation);
+
+	planes->saturation = NULL;
+	planes->luminance = NULL;
+
+	// a new slot is given back, others stay empty until the next attempt
+	if (is_new)
+		atlas_cache.planes_count -= 1;
+
+	return NULL;
+}
+
+VOID GetGlyphAtlas (PATLAS atlas, PGLYPH_ATLAS glyph_atlas)
+{
+	glyph_atlas->width = atlas_cache.columns * atlas->cell_size;
+	glyph_atlas->height = atlas_cache.rows * atlas->cell_size;
+
+	glyph_atlas->pixels = atlas->bits;
+	glyph_atlas->stride = glyph_atlas->width;
+
+	glyph_atlas->cell_width = atlas->cell_size;
+	glyph_atlas->cell_height = atlas->cell_size;
+
+	glyph_atlas->columns = atlas_cache.columns;
+}
+
+// gives the memory of an unreferenced atlas back, the slot is empty then
+VOID EvictAtlas (PATLAS atlas)
+{
+	if (atlas->view)
+	{
+		UnmapViewOfFile (atlas->view);
+	}
+	else if (atlas->bits)
+	{
+		_r_mem_free (atlas->bits);
+	}
+
+	atlas->view = NULL;
+	atlas->bits = NULL;
+	atlas->capacity = 0;
+
+	atlas->hue = 0;
+	atlas->cell_size = 0;
+	atlas->last_used = 0;
+}
+
+//
+// evicts unreferenced atlases, least recently used first, until "size"
+// more bytes fit ATLAS_CACHE_BYTES. mapped atlases only take file cache.
+// font atlases are large, so fewer than ATLAS_FONT_HUES_MAX of them are
+// left at "cell_size" as well.
+//
+VOID TrimAtlasCache (INT cell_size, SIZE_T size, BOOLEAN is_font)
+{
+	PATLAS atlas;
+	PATLAS victim;
+	PATLAS victim_size;
+	SIZE_T total;
+	INT same_size;
+
+	while (TRUE)
+	{
+		total = size;
+		same_size = 0;
+		victim = NULL;
+		victim_size = NULL;
+
+		for (INT i = 0; i < atlas_cache.count; i++)
+		{
+			atlas = &atlas_cache.atlas[i];
+
+			if (!atlas->bits)
+				continue;
+
+			total += atlas->capacity * sizeof (ULONG);
+
+			if (atlas->cell_size == cell_size)
+				same_size += 1;
+
+			if (atlas->ref_count)
+				continue;
+
+			if (!victim || atlas->last_used < victim->last_used)
+				victim = atlas;
+
+			if (atlas->cell_size == cell_size && (!victim_size || atlas->last_used < victim_size->last_used))
+				victim_size = atlas;
+		}
+
+		if (total > ATLAS_CACHE_BYTES && victim)
+		{
+			EvictAtlas (victim);
+		}
+		else if (is_font && same_size >= ATLAS_FONT_HUES_MAX && victim_size)
+		{
+			EvictAtlas (victim_size);
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+//
+// find the atlas for a hue and cell size, building it only when the pair
+// was not seen before or got evicted. the cache is kept within its byte
+// budget first, then an empty slot is taken, and when all slots are in
+// use the least recently used atlas which is not referenced by any matrix
+// gets recolored in place. the glyph planes are scaled once per size and
+// shared by hues.
+// the baked atlas is copied as it is, the planes are only loaded for any
+// other hue or size. font atlases with a cache file are mapped, the ones
+// of the configured hue get a cache file once they are built.
+//
+PATLAS AcquireAtlas (HDC hdc, INT hue, INT cell_size)
+{
+	PATLAS_PLANES planes = NULL;
+	PATLAS_PLANES save_planes = NULL;
+	PATLAS atlas = NULL;
+	PATLAS victim = NULL;
+	ATLAS_IMAGE image;
+	PVOID view = NULL;
+	SIZE_T count;
+	BOOLEAN is_font;
+
+	// hues 241-255 produce the same colours as 1-15
+	hue %= HLS_MAX;
+
+	AcquireSRWLockExclusive (&atlas_cache.lock);
+
+	atlas_cache.clock += 1;
+
+	for (INT i = 0; i < atlas_cache.count; i++)
+	{
+		atlas = &atlas_cache.atlas[i];
+
+		if (atlas->hue == hue && atlas->cell_size == cell_size)
+		{
+			atlas->last_used = atlas_cache.clock;
+			atlas->ref_count += 1;
+
+			goto CleanupExit;
+		}
+	}
+
+	atlas = NULL;
+
+	is_font = LoadFontSource ();
+
+	if (is_font)
+		view = MapAtlasCache (hue, cell_size, &image);
+
+	if (!view && (is_font || !LoadAtlasImage () || atlas_cache.image.hue != hue || atlas_cache.image.cell_width != cell_size))
+	{
+		if (!is_font && !LoadAtlasSource (hdc))
+			goto CleanupExit;
+
+		planes = GetAtlasPlanes (hdc, cell_size);
+
+		if (!planes)
+			goto CleanupExit;
+	}
+
+	count = (SIZE_T)atlas_cache.columns * cell_size * atlas_cache.rows * cell_size;
+
+	TrimAtlasCache (cell_size, view ? 0 : count * sizeof (ULONG), is_font);
+
+	for (INT i = 0; i < atlas_cache.count; i++)
+	{
+		if (!atlas_cache.atlas[i].bits)
+		{
+			atlas = &atlas_cache.atlas[i];
+			break;
+		}
+
+		if (!atlas_cache.atlas[i].ref_count && (!victim || atlas_cache.atlas[i].last_used < victim->last_used))
+			victim = &atlas_cache.atlas[i];
+	}
+
+	if (!atlas && atlas_cache.count < ATLAS_CACHE_MAX)
+	{
+		atlas = &atlas_cache.atlas[atlas_cache.count];
+
+		atlas_cache.count += 1;
+	}
+
+	if (!atlas)
+		atlas = victim;
+
+	if (!atlas)
+	{
+		if (view)
+			UnmapViewOfFile (view);
+
+		goto CleanupExit;
+	}
+
+	// the bits of a mapped atlas are not ours
+	if (atlas->view)
+	{
+		UnmapViewOfFile (atlas->view);
+
+		atlas->view = NULL;
+		atlas->bits = NULL;
+		atlas->capacity = 0;
+	}
+
+	// only unreferenced atlases are rebuilt, so no reader sees this
+	if (!view && atlas->capacity < count)
+	{
+		if (atlas->bits)
+			_r_mem_free (atlas->bits);
+
+		atlas->bits = _r_mem_allocatezero (count * sizeof (ULONG));
+		atlas->capacity = atlas->bits ? count : 0;
+
+		// an empty slot is picked again before anything is evicted
+		atlas->hue = 0;
+		atlas->cell_size = 0;
+		atlas->last_used = 0;
+
+		if (!atlas->bits)
+		{
+			atlas = NULL;
+			goto CleanupExit;
+		}
+	}
+
+	if (view)
+	{
+		if (atlas->bits)
+			_r_mem_free (atlas->bits);
+
+		atlas->view = view;
+		atlas->bits = (PULONG)image.pixels;
+		atlas->capacity = 0;
+	}
+	else if (planes)
+	{
+		RecolorPixels (atlas->bits, planes->saturation, planes->luminance, count, hue);
+
+		// other hues only come and go with the random colours, the file
+		// is written once the lock is released
+		if (is_font && hue == config.hue % HLS_MAX)
+		{
+			save_planes = planes;
+			save_planes->ref_count += 1;
+		}
+	}
+	else
+	{
+		RtlCopyMemory (atlas->bits, atlas_cache.image.pixels, count * sizeof (ULONG));
+	}
+
+	// the amount only goes up to the glyphs of an atlas being used
+	InterlockedExchange (&atlas_cache.glyphs, is_font ? atlas_cache.font_glyphs : atlas_cache.columns * (atlas_cache.rows / ATLAS_LEVELS));
+
+	atlas->hue = hue;
+	atlas->cell_size = cell_size;
+	atlas->last_used = atlas_cache.clock;
+	atlas->ref_count = 1;
+
+CleanupExit:
+
+	ReleaseSRWLockExclusive (&atlas_cache.lock);
+
+	if (save_planes)
+	{
+		SaveAtlasCache (hue, cell_size, save_planes, atlas->bits);
+
+		AcquireSRWLockExclusive (&atlas_cache.lock);
+		save_planes->ref_count -= 1;
+		ReleaseSRWLockExclusive (&atlas_cache.lock);
+	}
+
+	return atlas;
+}
+
+VOID ReleaseAtlas (PATLAS atlas)
+{
+	if (!atlas)
+		return;
+
+	AcquireSRWLockExclusive (&atlas_cache.lock);
+	atlas->ref_count -= 1;
+	ReleaseSRWLockExclusive (&atlas_cache.lock);
+}
+
+VOID DestroyAtlasCache ()
+{
+	for (INT i = 0; i < atlas_cache.count; i++)
+	{
+		if (atlas_cache.atlas[i].view)
+		{
+			UnmapViewOfFile (atlas_cache.atlas[i].view);
+		}
+		else if (atlas_cache.atlas[i].bits)
+		{
+			_r_mem_free (atlas_cache.atlas[i].bits);
+		}
+	}
+
+	for (INT i = 0; i < atlas_cache.planes_count; i++)
+	{
+		if (atlas_cache.planes[i].saturation)
+			_r_mem_free (atlas_cache.planes[i].saturation);
+	}
+
+	RtlSecureZeroMemory (&atlas_cache, sizeof (atlas_cache));
+}
+
+//
+// glyphs the amount setting may go up to, known before the first atlas
+// is built. the font range is not checked against the font itself.
+//
+INT GetGlyphLimit ()
+{
+	LONG glyphs = atlas_cache.glyphs;
+	INT count = GLYPH_BITMAP_GLYPHS;
+
+	if (glyphs)
+		return glyphs;
+
+	if (config.font[0] && config.font_first >= 0x20 && config.font_last >= config.font_first && config.font_last <= 0xFFFF)
+	{
+		count = config.font_last - config.font_first + 1;
+
+		return (count > GLYPHS_MAX) ? GLYPHS_MAX : count;
+	}
+
+	// render threads may be loading it as well
+	AcquireSRWLockExclusive (&atlas_cache.lock);
+
+	if (LoadAtlasImage ())
+		count = atlas_cache.image.columns * (atlas_cache.image.rows / ATLAS_LEVELS);
+
+	ReleaseSRWLockExclusive (&atlas_cache.lock);
+
+	return count;
+}
+
+// glyph indices past the atlas would be drawn from outside of it
+INT GetGlyphAmount ()
+{
+	LONG glyphs = atlas_cache.glyphs;
+
+	if (!glyphs)
+		return AMOUNT_MIN;
+
+	return (config.amount > glyphs) ? glyphs : config.amount;
+}
+
+VOID SetMatrixBitmap (HDC hdc, PMATRIX_VIEW view, INT hue)
+{
+	PATLAS atlas;
+	INT cell_size = view->matrix->cell_width;
+
+	// fast path, nothing to do until the hue or the cell size changes
+	if (view->atlas && view->atlas->hue == hue % HLS_MAX && view->atlas->cell_size == cell_size)
+		return;
+
+	atlas = AcquireAtlas (hdc, hue, cell_size);
+
+	if (!atlas)
+		return;
+
+	ReleaseAtlas (view->atlas);
+
+	view->atlas = atlas;
+}
+
+VOID PresentMatrix (HDC hdc, PMATRIX matrix)
+{
+	PFRAMEBUFFER framebuffer = matrix->framebuffer;
+	BITMAPINFO bmi = {0};
+
+	bmi.bmiHeader.biSize = sizeof (BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = (LONG)framebuffer->stride;
+	bmi.bmiHeader.biHeight = -framebuffer->height; // top-down
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	// the whole frame goes out in a single call
+	SetDIBitsToDevice (hdc, 0, 0, framebuffer->width, framebuffer->height, 0, 0, 0, framebuffer->height, framebuffer->pixels, &bmi, DIB_RGB_COLORS);
+}
+
+VOID PresentDirtyRegion (HDC hdc, PMATRIX_VIEW view)
+{
+	PDIRTY_REGION dirty = &view->matrix->framebuffer->dirty;
+	PRGNDATA rgndata = view->rgndata;
+	PRECT rect;
+	HRGN hrgn;
+
+	if (dirty->is_full)
+	{
+		PresentMatrix (hdc, view->matrix);
+		return;
+	}
+
+	if (!dirty->count)
+		return;
+
+	rgndata->rdh.dwSize = sizeof (RGNDATAHEADER);
+	rgndata->rdh.iType = RDH_RECTANGLES;
+	rgndata->rdh.nCount = dirty->count;
+	rgndata->rdh.nRgnSize = dirty->count * sizeof (RECT);
+
+	SetRect (&rgndata->rdh.rcBound, 0, 0, view->matrix->width, view->matrix->height);
+
+	rect = (PRECT)rgndata->Buffer;
+
+	for (INT i = 0; i < dirty->count; i++)
+		SetRect (&rect[i], dirty->rect[i].left, dirty->rect[i].top, dirty->rect[i].right, dirty->rect[i].bottom);
+
+	hrgn = ExtCreateRegion (NULL, sizeof (RGNDATAHEADER) + rgndata->rdh.nRgnSize, rgndata);
+
+	if (!hrgn)
+	{
+		PresentMatrix (hdc, view->matrix);
+		return;
+	}
+
+	// only the union of the dirty rectangles gets transferred
+	SelectClipRgn (hdc, hrgn);
+	PresentMatrix (hdc, view->matrix);
+	SelectClipRgn (hdc, NULL);
+
+	DeleteObject (hrgn);
+}
+
+FORCEINLINE LONG64 GetClockTime ()
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter (&counter);
+
+	return counter.QuadPart;
+}
+
+VOID NTAPI UpdateMatrixChunk (PVOID context, INT chunk)
+{
+	PMATRIX_JOB job = context;
+	LONG64 phase[FRAME_PHASE_DRAW + 1] = {0};
+	LONG64 start;
+	LONG64 now;
+	ULONG cells = 0;
+	INT first = chunk * WORKER_CHUNK_COLUMNS;
+	INT count = job->matrix->numcols - first;
+
+	if (count > WORKER_CHUNK_COLUMNS)
+		count = WORKER_CHUNK_COLUMNS;
+
+	start = GetClockTime ();
+
+	// the whole chunk is drawn after it, so nothing gets flagged per glyph
+	if (job->prewarm)
+	{
+		PrewarmMatrixColumns (job->matrix, first, count, job->prewarm);
+
+		now = GetClockTime ();
+		phase[FRAME_PHASE_SCROLL] += now - start;
+		start = now;
+	}
+
+	// dirty bits add up, so skipped steps are drawn with the last one
+	for (INT i = 0; i < job->steps; i++)
+	{
+		for (INT x = first; x < first + count; x++)
+			RandomMatrixColumn (job->matrix, &job->matrix->column[x]);
+
+		now = GetClockTime ();
+		phase[FRAME_PHASE_RANDOM] += now - start;
+		start = now;
+
+		ScrollMatrixColumns (job->matrix, first, count);
+
+		now = GetClockTime ();
+		phase[FRAME_PHASE_SCROLL] += now - start;
+		start = now;
+	}
+
+	if (job->atlas)
+	{
+		if (job->decay)
+			cells = (ULONG)DrawPhosphorColumns (job->matrix, job->atlas, first, count, job->decay);
+		else
+			cells = (ULONG)DrawMatrixColumns (job->matrix, job->atlas, first, count);
+
+		phase[FRAME_PHASE_DRAW] += GetClockTime () - start;
+	}
+
+	// a handful of interlocked adds per chunk keeps the counters cheap
+	for (SIZE_T i = 0; i < RTL_NUMBER_OF (phase); i++)
+		InterlockedExchangeAdd64 (&job->phase[i], phase[i]);
+
+	InterlockedExchangeAdd (&job->cells, (LONG)cells);
+}
+
+VOID DrawStatsOverlay (PMATRIX_VIEW view, const GLYPH_ATLAS *glyph_atlas)
+{
+	CHAR text[256];
+	INT scale;
+
+	StatsFormat (&view->stats, text, RTL_NUMBER_OF (text));
+
+	// readable at any resolution, 2 pixels per dot at 1080p
+	scale = view->matrix->height / 540;
+
+	if (scale < 1)
+		scale = 1;
+
+	DrawOverlay (view->matrix, 0, 0, text, scale, GetOverlayColor (glyph_atlas));
+}
+
+VOID TraceStartup ()
+{
+	LARGE_INTEGER frequency;
+	CHAR text[128];
+	LONG64 now = GetClockTime ();
+
+	if (InterlockedExchange (&startup.is_done, TRUE))
+		return;
+
+	QueryPerformanceFrequency (&frequency);
+
+	snprintf (text, RTL_NUMBER_OF (text), "matrix: %s first frame after %.1f ms, %s atlas in %.2f ms\n", startup.mode ? startup.mode : "", (now - startup.start) * 1000.0 / frequency.QuadPart, atlas_cache.is_font ? "font" : atlas_cache.image.pixels ? "baked" : "decoded", startup.atlas * 1000.0 / frequency.QuadPart);
+
+	OutputDebugStringA (text);
+}
+
+// returns the cost of the frame, in performance counter ticks
+LONG64 DecodeMatrix (HWND hwnd, PMATRIX_VIEW view, INT steps)
+{
+	PMATRIX matrix = view->matrix;
+	PDIRTY_REGION dirty = &matrix->framebuffer->dirty;
+	FRAME_SAMPLE sample = {0};
+	GLYPH_ATLAS glyph_atlas;
+	MATRIX_JOB job = {0};
+	LONG64 frame_start;
+	LONG64 start;
+	HDC hdc;
+
+	frame_start = GetClockTime ();
+
+	hdc = GetDC (hwnd);
+
+	if (!hdc)
+		return 0;
+
+	if (!view->hue)
+		view->hue = config.hue;
+
+	matrix->amount = GetGlyphAmount ();
+	matrix->density = config.density;
+
+	GovernorApply (&view->governor, matrix);
+
+	matrix->framebuffer->dirty.limit = config.max_dirty_rects;
+
+	job.matrix = matrix;
+	job.steps = steps;
+	job.decay = (config.phosphor > 0) ? config.phosphor : 0;
+
+	// a fast-forward changes every glyph in view
+	if (view->prewarm)
+	{
+		job.prewarm = view->prewarm;
+		view->prewarm = 0;
+
+		InterlockedExchange (&view->is_invalid, TRUE);
+	}
+
+	// an atlas of another cell size draws nothing, the redraw flags
+	// are kept until one of the right size is in place
+	if (view->atlas && view->atlas->cell_size == matrix->cell_width)
+	{
+		GetGlyphAtlas (view->atlas, &glyph_atlas);
+
+		job.atlas = &glyph_atlas;
+	}
+
+	// columns are independent, so chunks run on any thread in any order
+	RunWorkerPool (workers, (matrix->numcols + WORKER_CHUNK_COLUMNS - 1) / WORKER_CHUNK_COLUMNS, &UpdateMatrixChunk, &job);
+
+	start = GetClockTime ();
+
+	if (job.atlas)
+	{
+		BuildDirtyRegion (matrix);
+
+		// every pixel fades, so the whole frame is presented
+		if (job.decay)
+			AddDirtyRect (dirty, 0, 0, matrix->width, matrix->height);
+
+		if (config.is_stats)
+			DrawStatsOverlay (view, job.atlas);
+	}
+
+	sample.phase[FRAME_PHASE_RANDOM] = job.phase[FRAME_PHASE_RANDOM];
+	sample.phase[FRAME_PHASE_SCROLL] = job.phase[FRAME_PHASE_SCROLL];
+	sample.phase[FRAME_PHASE_DRAW] = job.phase[FRAME_PHASE_DRAW] + (GetClockTime () - start);
+	sample.cells = (ULONG)job.cells;
+	sample.quality = view->governor.level;
+
+	start = GetClockTime ();
+
+	// the window got invalidated, it needs the whole frame
+	if (InterlockedExchange (&view->is_invalid, FALSE))
+	{
+		PresentMatrix (hdc, matrix);
+		sample.blits = 1;
+	}
+	else if (job.atlas)
+	{
+		PresentDirtyRegion (hdc, view);
+		sample.blits = dirty->is_full ? 1 : dirty->count;
+	}
+
+	sample.phase[FRAME_PHASE_PRESENT] = GetClockTime () - start;
+
+	// once per process, the first frame of any view
+	if (!startup.is_done)
+		TraceStartup ();
+
+	if (config.is_random)
+	{
+		if (config.is_smooth)
+		{
+			for (INT i = 0; i < steps; i++)
+				view->hue = (view->hue >= HUE_MAX) ? HUE_MIN : view->hue + 1;
+		}
+		else
+		{
+			if (_r_sys_gettickcount () % 2)
+				view->hue = (INT)_r_math_rand (HUE_MIN, HUE_MAX);
+		}
+	}
+	else
+	{
+		view->hue = config.hue;
+	}
+
+	start = GetClockTime ();
+
+	SetMatrixBitmap (hdc, view, view->hue);
+
+	sample.phase[FRAME_PHASE_ATLAS] = GetClockTime () - start;
+
+	ReleaseDC (hwnd, hdc);
+
+	sample.total = GetClockTime () - frame_start;
+
+	StatsAddFrame (&view->stats, &sample);
+
+	return sample.total;
+}
+
+// simulation step in performance counter ticks
+FORCEINLINE LONG64 GetStepPeriod (LONG64 frequency)
+{
+	return frequency * MatrixStepTime (config.speed) / 1000;
+}
+
+//
+//	Wait until "due" clock ticks passed or the view gets stopped. High
+//	resolution timers are not affected by the system timer granularity,
+//	older systems fall back to a plain waitable timer.
+//
+BOOLEAN WaitForFrame (PMATRIX_VIEW view, HANDLE htimer, LONG64 due, LONG64 frequency, BOOLEAN is_vsync)
+{
+	HANDLE handles[2] = {view->hstop, htimer};
+	LARGE_INTEGER due_time;
+
+	// composition paces the frames, no timer needed
+	if (is_vsync && SUCCEEDED (DwmFlush ()))
+		return WaitForSingleObject (view->hstop, 0) == WAIT_TIMEOUT;
+
+	if (due <= 0)
+		return WaitForSingleObject (view->hstop, 0) == WAIT_TIMEOUT;
+
+	// relative, in 100ns units
+	due_time.QuadPart = -((due * 10000000) / frequency);
 
-	config.is_esc_only = _r_config_getboolean (L"IsEscOnly", FALSE);
+	if (!due_time.QuadPart)
+		due_time.QuadPart = -1;
 
-	config.is_random = _r_config_getboolean (L"Random", HUE_RANDOM);
-	config.is_smooth = _r_config_getboolean (L"RandomSmoothTransition", HUE_RANDOM_SMOOTHTRANSITION);
+	if (!htimer || !SetWaitableTimer (htimer, &due_time, 0, NULL, NULL, FALSE))
+		return WaitForSingleObject (view->hstop, (ULONG)((due * 1000) / frequency)) == WAIT_TIMEOUT;
+
+	return WaitForMultipleObjects (RTL_NUMBER_OF (handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1;
 }
 
-VOID SaveSettings ()
+// minimum ticks between two presented frames, zero when not throttled
+FORCEINLINE LONG64 GetFrameInterval (LONG64 frequency)
 {
-	_r_config_setinteger (L"Speed", config.speed);
-	_r_config_setinteger (L"NumGlyphs", config.amount);
-	_r_config_setinteger (L"Density", config.density);
-	_r_config_setinteger (L"Hue", config.hue);
+	INT fps = config.battery_fps;
 
-	_r_config_setboolean (L"IsEscOnly", config.is_esc_only);
+	if (!config.is_battery || fps <= 0)
+		return 0;
 
-	_r_config_setboolean (L"Random", config.is_random);
-	_r_config_setboolean (L"RandomSmoothTransition", config.is_smooth);
-}
+	if (fps > BATTERY_FPS_MAX)
+		fps = BATTERY_FPS_MAX;
 
-FORCEINLINE COLORREF HSLtoRGB (WORD h, WORD s, WORD l)
-{
-	return ColorHLSToRGB (h, l, s);
+	return frequency / fps;
 }
 
-FORCEINLINE VOID RGBtoHSL (COLORREF clr, PWORD h, PWORD s, PWORD l)
+//
+//	Minimized and cloaked windows (on another virtual desktop) show
+//	nothing, neither do windows without a visible clip box. The last
+//	check only catches covered windows without composition, redirected
+//	windows always have one.
+//
+BOOLEAN IsViewVisible (PMATRIX_VIEW view)
 {
-	ColorRGBToHLS (clr, h, l, s);
-}
+	HWND hroot = GetAncestor (view->hwnd, GA_ROOT);
+	ULONG is_cloaked = 0;
+	RECT rect;
+	HDC hdc;
+	INT region;
 
-FORCEINLINE GLYPH GlyphIntensity (GLYPH glyph)
-{
-	return ((glyph & 0x7F00) >> 8);
+	// also false when the settings dialog of the preview is hidden
+	if (!IsWindowVisible (view->hwnd) || IsIconic (hroot))
+		return FALSE;
+
+	if (SUCCEEDED (DwmGetWindowAttribute (hroot, DWMWA_CLOAKED, &is_cloaked, sizeof (is_cloaked))) && is_cloaked)
+		return FALSE;
+
+	hdc = GetDC (view->hwnd);
+
+	if (!hdc)
+		return TRUE;
+
+	region = GetClipBox (hdc, &rect);
+
+	ReleaseDC (view->hwnd, hdc);
+
+	return region != NULLREGION;
 }
 
-FORCEINLINE GLYPH RandomGlyph (INT intensity)
+VOID UpdateBatteryState ()
 {
-	return GLYPH_REDRAW | (intensity << 8) | (_r_math_rand (0, RND_MAX) % config.amount);
+	SYSTEM_POWER_STATUS status;
+
+	// an unknown line status counts as mains power
+	if (GetSystemPowerStatus (&status))
+		InterlockedExchange (&config.is_battery, status.ACLineStatus == AC_LINE_OFFLINE);
 }
 
-FORCEINLINE GLYPH DarkenGlyph (GLYPH glyph)
+VOID HandlePowerBroadcast (WPARAM wparam, LPARAM lparam)
 {
-	GLYPH intensity = GlyphIntensity (glyph);
+	PPOWERBROADCAST_SETTING setting;
 
-	if (intensity > 0)
+	if (wparam == PBT_APMPOWERSTATUSCHANGE || wparam == PBT_APMRESUMEAUTOMATIC)
 	{
-		return GLYPH_REDRAW | ((intensity - 1) << 8) | (glyph & 0x00FF);
+		UpdateBatteryState ();
 	}
+	else if (wparam == PBT_POWERSETTINGCHANGE)
+	{
+		setting = (PPOWERBROADCAST_SETTING)lparam;
 
-	return glyph;
+		// 0 is off, 1 is on and 2 is dimmed
+		if (setting && IsEqualGUID (&setting->PowerSetting, &display_state_guid) && setting->DataLength >= sizeof (ULONG))
+			InterlockedExchange (&config.is_display_off, *(PULONG)setting->Data == 0);
+	}
 }
 
-FORCEINLINE VOID DrawGlyph (PMATRIX matrix, HDC hdc, INT xpos, INT ypos, GLYPH glyph)
+// runs on the render thread, which owns the matrix
+VOID ApplyPendingResize (PMATRIX_VIEW view)
 {
-	GLYPH intensity = GlyphIntensity (glyph);
-	INT glyph_idx = glyph & 0xff;
+	PMATRIX matrix;
+	LONG64 size;
+	INT cell_size;
+	INT height;
+	INT width;
 
-	BitBlt (hdc, xpos, ypos, GLYPH_WIDTH, GLYPH_HEIGHT, matrix->hdc, glyph_idx * GLYPH_WIDTH, intensity * GLYPH_HEIGHT, SRCCOPY);
-}
+	size = InterlockedExchange64 (&view->resize, 0);
 
-FORCEINLINE VOID RedrawBlip (PGLYPH glyph_arr, INT blip_pos)
-{
-	glyph_arr[blip_pos + 0] |= GLYPH_REDRAW;
-	glyph_arr[blip_pos + 1] |= GLYPH_REDRAW;
-	glyph_arr[blip_pos + 8] |= GLYPH_REDRAW;
-	glyph_arr[blip_pos + 9] |= GLYPH_REDRAW;
-}
+	cell_size = view->cell_size;
 
-VOID ScrollMatrixColumn (PMATRIX_COLUMN column)
-{
-	GLYPH last_glyph;
-	GLYPH current_glyph;
-	GLYPH current_glyph_intensity;
+	if (!size && cell_size == view->matrix->cell_width)
+		return;
 
-	// wait until we are allowed to scroll
-	if (!column->is_started)
+	// a new dpi alone keeps the client size
+	if (size)
+	{
+		width = (INT)(size >> 32);
+		height = (INT)(size & 0xFFFFFFFF);
+	}
+	else
 	{
-		if (--column->countdown <= 0)
-			column->is_started = TRUE;
+		width = view->matrix->width;
+		height = view->matrix->height;
+	}
+
+	matrix = ResizeMatrix (view->matrix, width, height, cell_size);
 
+	// out of memory, the old grid is still intact
+	if (!matrix)
 		return;
-	}
 
-	// "seed" the glyph-run
-	last_glyph = column->state ? 0 : (MAX_INTENSITY << 8);
+	view->matrix = matrix;
+
+	// glyphs of another cell size are not drawn, every glyph in view is
+	// flagged now and the flags are gone after the next frame
+	SetMatrixBitmap (NULL, view, view->hue ? view->hue : config.hue);
+
+	InterlockedExchange (&view->is_invalid, TRUE);
+}
+
+//
+//	Frames are only simulated while they can be seen. A view coming
+//	back runs the missed steps without drawing, at most one screen
+//	height of them since older glyphs have scrolled out by then, and
+//	presents the result in full.
+//
+ULONG WINAPI RenderThreadProc (PVOID lparam)
+{
+	PMATRIX_VIEW view = lparam;
+	FRAME_SCHEDULE schedule;
+	LARGE_INTEGER frequency;
+	HANDLE htimer;
+	LONG64 next_frame = 0;
+	LONG64 next_poll = 0;
+	LONG64 interval = 0;
+	LONG64 period;
+	LONG64 cost;
+	LONG64 due;
+	LONG64 now;
+	BOOLEAN is_suspended = FALSE;
+	BOOLEAN is_visible = TRUE;
+	INT catchup;
+	INT steps;
+
+	QueryPerformanceFrequency (&frequency);
+
+	StatsInit (&view->stats, frequency.QuadPart);
+
+	GovernorInit (&view->governor, config.quality, config.quality_floor);
+
+	htimer = CreateWaitableTimerEx (NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+	if (!htimer)
+		htimer = CreateWaitableTimerEx (NULL, NULL, 0, TIMER_ALL_ACCESS);
+
+	period = GetStepPeriod (frequency.QuadPart);
 
-	//
-	// loop over the entire length of the column, looking for changes
-	// in intensity/darkness. This change signifies the start/end
-	// of a run of glyphs.
-	//
-	for (INT y = 0; y < column->length; y++)
+	ScheduleInit (&schedule, GetClockTime (), period, config.max_catchup);
+
+	due = ScheduleWaitTime (&schedule, GetClockTime ());
+
+	// throttled and suspended views wait on the timer, not on composition
+	while (WaitForFrame (view, htimer, due, frequency.QuadPart, config.is_vsync && !interval && !is_suspended))
 	{
-		current_glyph = column->glyph[y];
+		ApplyPendingResize (view);
 
-		current_glyph_intensity = GlyphIntensity (current_glyph);
+		now = GetClockTime ();
 
-		// bottom-most part of "run". Insert a new character (glyph)
-		// at the end to lengthen the run down the screen..gives the
-		// impression that the run is "falling" down the screen
-		if (current_glyph_intensity < GlyphIntensity (last_glyph) && current_glyph_intensity == 0)
+		if (now >= next_poll)
 		{
-			column->glyph[y] = RandomGlyph (MAX_INTENSITY - 1);
-			y += 1;
+			is_visible = IsViewVisible (view);
+			next_poll = now + (frequency.QuadPart * VISIBILITY_POLL_MS / 1000);
 		}
-		// top-most part of "run". Delete a character off the top by
-		// darkening the glyph until it eventually disappears (turns black). 
-		// this gives the effect that the run as dropped downwards
-		else if (current_glyph_intensity > GlyphIntensity (last_glyph))
+
+		if (!is_visible || config.is_display_off)
 		{
-			column->glyph[y] = DarkenGlyph (current_glyph);
+			is_suspended = TRUE;
+			due = next_poll - now;
 
-			// if we've just darkened the last bit, skip on so
-			// the whole run doesn't go dark
-			if (current_glyph_intensity == MAX_INTENSITY - 1)
-				y++;
+			continue;
 		}
 
-		last_glyph = column->glyph[y];
-	}
+		// speed changes keep the phase of the schedule
+		if (period != GetStepPeriod (frequency.QuadPart))
+		{
+			period = GetStepPeriod (frequency.QuadPart);
+			ScheduleSetPeriod (&schedule, period);
+		}
 
-	// change state from blanks <-> runs when the current run as expired
-	if (--column->run_length <= 0)
-	{
-		INT density = DENSITY_MAX - config.density + DENSITY_MIN;
+		// on battery fewer frames run more steps each, the speed stays the same
+		interval = GetFrameInterval (frequency.QuadPart);
 
-		if (column->state ^= 1)
+		catchup = config.max_catchup;
+
+		if (interval && catchup < (interval + period - 1) / period)
+			catchup = (INT)((interval + period - 1) / period);
+
+		ScheduleSetCatchup (&schedule, catchup);
+
+		if (is_suspended)
 		{
-			column->run_length = _r_math_rand (0, RND_MAX) % (3 * density / 2) + DENSITY_MIN;
+			is_suspended = FALSE;
+
+			steps = ScheduleResume (&schedule, now, view->matrix->numrows);
+
+			// the frame is presented in full, the steps in between need no tracking
+			if (steps > 1)
+			{
+				view->prewarm = steps - 1;
+				steps = 1;
+			}
+
+			InterlockedExchange (&view->is_invalid, TRUE);
 		}
 		else
 		{
-			column->run_length = _r_math_rand (0, RND_MAX) % (DENSITY_MAX + 1 - density) + (DENSITY_MIN * 2);
+			steps = (now >= next_frame) ? ScheduleAdvance (&schedule, now) : 0;
 		}
-	}
 
-	// mark current blip as redraw so it gets "erased"
-	if (column->blip_pos >= 0 && column->blip_pos < column->length)
-		RedrawBlip (column->glyph, column->blip_pos);
+		if (steps)
+		{
+			cost = DecodeMatrix (view->hwnd, view, steps);
 
-	// advance down screen at double-speed
-	column->blip_pos += 2;
+			// the frame has until the next one is due, steps it had to
+			// catch up on are a sign of overload and add no budget
+			GovernorAddFrame (&view->governor, cost, (interval > period) ? interval : period);
 
-	// if the blip gets to the end of a run, start it again (for a random
-	// length so that the blips never get synched together)
-	if (column->blip_pos >= column->blip_length)
-	{
-		column->blip_length = column->length + (_r_math_rand (0, RND_MAX) % 50);
-		column->blip_pos = 0;
+			next_frame = now + interval;
+		}
+
+		now = GetClockTime ();
+		due = ScheduleWaitTime (&schedule, now);
+
+		if (next_frame - now > due)
+			due = next_frame - now;
 	}
 
-	// now redraw blip at new position
-	if (column->blip_pos >= 0 && column->blip_pos < column->length)
-		RedrawBlip (column->glyph, column->blip_pos);
+	if (htimer)
+		CloseHandle (htimer);
+
+	return ERROR_SUCCESS;
 }
 
-//
-// randomly change a small collection glyphs in a column
-//
-VOID RandomMatrixColumn (PMATRIX_COLUMN column)
+BOOLEAN StartRenderThread (PMATRIX_VIEW view)
 {
-	ULONG rand;
-
-	for (INT i = 1, y = 0; i < 16; i++)
-	{
-		// find a run
-		while (y < column->length && GlyphIntensity (column->glyph[y]) < (MAX_INTENSITY - 1))
-			y += 1;
+	view->hstop = CreateEvent (NULL, TRUE, FALSE, NULL);
 
-		if (y >= column->length)
-			break;
+	if (!view->hstop)
+		return FALSE;
 
-		rand = _r_math_rand (0, RND_MAX);
+	view->hthread = CreateThread (NULL, 0, &RenderThreadProc, view, 0, NULL);
 
-		column->glyph[y] = (column->glyph[y] & 0xFF00) | (rand % config.amount);
-		column->glyph[y] |= GLYPH_REDRAW;
+	if (!view->hthread)
+	{
+		CloseHandle (view->hstop);
+		view->hstop = NULL;
 
-		y += rand % 10;
+		return FALSE;
 	}
+
+	return TRUE;
 }
 
-VOID RedrawMatrixColumn (PMATRIX_COLUMN column, PMATRIX matrix, HDC hdc, INT xpos)
+VOID StopRenderThread (PMATRIX_VIEW view)
 {
-	// loop down the length of the column redrawing only what needs doing
-	for (INT y = 0; y < column->length; y++)
-	{
-		GLYPH glyph = column->glyph[y];
+	if (!view->hthread)
+		return;
 
-		// does this glyph (character) need to be redrawn?
-		if (glyph & GLYPH_REDRAW)
-		{
-			if ((GlyphIntensity (glyph) >= MAX_INTENSITY - 1) && (y == column->blip_pos + 0 || y == column->blip_pos + 1 || y == column->blip_pos + 8 || y == column->blip_pos + 9))
-				glyph |= MAX_INTENSITY << 8;
+	SetEvent (view->hstop);
+	WaitForSingleObject (view->hthread, INFINITE);
 
-			DrawGlyph (matrix, hdc, xpos, y * GLYPH_HEIGHT, glyph);
+	CloseHandle (view->hthread);
+	CloseHandle (view->hstop);
 
-			// clear redraw state
-			column->glyph[y] &= ~GLYPH_REDRAW;
-		}
-	}
+	view->hthread = NULL;
+	view->hstop = NULL;
 }
 
-HBITMAP MakeBitmap (HDC hdc, HINSTANCE hinst, UINT type, INT hue)
+PMATRIX_VIEW CreateMatrixView (INT width, INT height, INT cell_size)
 {
-	DIBSECTION dib = {0};
-	LPBITMAPINFOHEADER lpbih;
-	PULONG dest = NULL;
-	PBYTE src;
+	MATRIX_HOOKS hooks = {0};
+	PMATRIX_VIEW view;
+	LONG64 start;
+	HDC hdc;
 
-	RGBQUAD pal[256] = {0};
+	hooks.allocate = &MatrixAllocate;
+	hooks.free = &MatrixFree;
+	hooks.random = &MatrixRandom;
 
-	// load the 8bit image
-	HBITMAP hglyph = LoadImage (hinst, MAKEINTRESOURCE (IDR_GLYPH), IMAGE_BITMAP, 0, 0, LR_CREATEDIBSECTION);
+	view = _r_mem_allocatezero (sizeof (MATRIX_VIEW));
 
-	// extract the colour table
-	HDC hdc_c = CreateCompatibleDC (hdc);
-	HANDLE hbitmap_old = SelectObject (hdc_c, hglyph);
-	GetDIBColorTable (hdc_c, 0, RTL_NUMBER_OF (pal), pal);
-	SelectObject (hdc_c, hbitmap_old);
+	view->matrix = CreateMatrix (width, height, cell_size, (ULONG)config.seed, &hooks);
 
-	GetObject (hglyph, sizeof (dib), &dib);
+	if (!view->matrix)
+	{
+		_r_mem_free (view);
+		return NULL;
+	}
+
+	if (!CreateMatrixFramebuffer (view->matrix))
+	{
+		DestroyMatrix (view->matrix);
+		_r_mem_free (view);
 
-	src = dib.dsBm.bmBits;
-	lpbih = &dib.dsBmih;
+		return NULL;
+	}
+
+	view->rgndata = _r_mem_allocatezero (sizeof (RGNDATAHEADER) + (DIRTY_RECTS_MAX * sizeof (RECT)));
 
-	// change to a 32bit bitmap
-	dib.dsBm.bmBitsPixel = 32;
-	dib.dsBm.bmPlanes = 1;
-	dib.dsBm.bmWidthBytes = dib.dsBm.bmWidth * 4;
-	dib.dsBmih.biBitCount = 32;
-	dib.dsBmih.biPlanes = 1;
-	dib.dsBmih.biCompression = BI_RGB;
-	dib.dsBmih.biSizeImage = (dib.dsBmih.biWidth * dib.dsBmih.biHeight) * 4;
+	view->matrix->density = config.density;
 
-	// create a new (blank) 32bit DIB section
-	HBITMAP hDIB = CreateDIBSection (hdc_c, (LPBITMAPINFO)&dib.dsBmih, DIB_RGB_COLORS, &dest, 0, 0);
+	view->cell_size = view->matrix->cell_width;
 
-	// copy each pixel
-	for (LONG i = 0; i < lpbih->biWidth * lpbih->biHeight; i++)
+	hdc = GetDC (NULL);
+
+	if (hdc)
 	{
-		// convert 8bit palette entry to 32bit colour
-		RGBQUAD rgb = pal[*src++];
-		COLORREF clr = RGB (rgb.rgbRed, rgb.rgbGreen, rgb.rgbBlue);
+		start = GetClockTime ();
 
-		// convert the RGB colour to H,S,L values
-		WORD h, s, l;
-		RGBtoHSL (clr, &h, &s, &l);
+		view->atlas = AcquireAtlas (hdc, config.hue, view->matrix->cell_width);
 
-		// create the new colour
-		*dest++ = HSLtoRGB ((WORD)hue, s, l);
+		if (!startup.atlas)
+			startup.atlas = GetClockTime () - start;
+
+		ReleaseDC (NULL, hdc);
 	}
 
-	DeleteObject (hglyph);
-	DeleteDC (hdc_c);
+	// known once there is an atlas
+	view->matrix->amount = GetGlyphAmount ();
 
-	return hDIB;
+	// the first frame shows a screen which has been running for a while
+	if (config.is_prewarm)
+		view->prewarm = MatrixPrewarmTicks (view->matrix);
+
+	return view;
 }
 
-VOID SetMatrixBitmap (HDC hdc, PMATRIX matrix, INT hue)
+VOID DestroyMatrixView (PMATRIX_VIEW view)
 {
-	HBITMAP hbitmap;
-	HBITMAP hbitmap_old;
-
-	hbitmap = MakeBitmap (hdc, _r_sys_getimagebase (), IDR_GLYPH, hue);
-
-	if (!hbitmap)
-		return;
+	StopRenderThread (view);
 
-	hbitmap_old = SelectObject (matrix->hdc, hbitmap);
+	if (view->hpower)
+		UnregisterPowerSettingNotification (view->hpower);
 
-	if (hbitmap_old)
-		DeleteObject (hbitmap_old);
+	ReleaseAtlas (view->atlas);
 
-	matrix->hbitmap = hbitmap;
+	DestroyMatrix (view->matrix);
 
-	SelectObject (matrix->hdc, matrix->hbitmap);
+	_r_mem_free (view->rgndata);
+	_r_mem_free (view);
 }
 
-VOID DecodeMatrix (HWND hwnd, PMATRIX matrix)
+bool VideoFileSink (PVOID context, LPCVOID data, SIZE_T size)
 {
-	PMATRIX_COLUMN column;
-	HDC hdc;
-	static INT new_hue = 0;
+	const BYTE *ptr = data;
+	ULONG written;
+	ULONG chunk;
 
-	hdc = GetDC (hwnd);
+	while (size)
+	{
+		chunk = (size > 0x40000000) ? 0x40000000 : (ULONG)size;
 
-	if (!hdc)
-		return;
+		if (!WriteFile (context, ptr, chunk, &written, NULL) || !written)
+			return false;
 
-	if (!new_hue)
-		new_hue = config.hue;
+		ptr += written;
+		size -= written;
+	}
 
-	for (INT x = 0; x < matrix->numcols; x++)
-	{
-		column = &matrix->column[x];
+	return true;
+}
 
-		RandomMatrixColumn (column);
-		ScrollMatrixColumn (column);
-		RedrawMatrixColumn (column, matrix, hdc, x * GLYPH_WIDTH);
+//
+//	/v WIDTHxHEIGHT FRAMES [FILE]
+//
+//	Renders without a window and without a timer, as fast as the
+//	simulation allows. Frames go to stdout when no file is given,
+//	".rgb" files get raw rgb and everything else yuv4mpeg2.
+//
+BOOLEAN RenderVideo (LPCWSTR args)
+{
+	WCHAR path[MAX_PATH] = {0};
+	VIDEO_FORMAT format = VIDEO_FORMAT_Y4M;
+	GLYPH_ATLAS glyph_atlas;
+	VIDEO_WRITER writer;
+	MATRIX_JOB job;
+	PMATRIX_VIEW view;
+	PBYTE buffer = NULL;
+	PBYTE frame = NULL;
+	LPCWSTR ext;
+	HANDLE hfile;
+	SIZE_T length = 0;
+	BOOLEAN is_success = FALSE;
+	INT offset = 0;
+	INT width;
+	INT height;
+	INT frames;
+	INT hue;
+
+	if (swscanf_s (args, L"%dx%d %d %n", &width, &height, &frames, &offset) != 3 || width <= 0 || height <= 0 || frames <= 0)
+		return FALSE;
+
+	// the rest of the line is the file name, quotes are optional
+	for (LPCWSTR ptr = args + offset; *ptr && length < RTL_NUMBER_OF (path) - 1; ptr++)
+	{
+		if (*ptr != L'"')
+			path[length++] = *ptr;
 	}
 
-	if (config.is_random)
+	while (length && path[length - 1] == L' ')
+		path[--length] = UNICODE_NULL;
+
+	if (!length || (length == 1 && path[0] == L'-'))
 	{
-		if (config.is_smooth)
-		{
-			new_hue = (new_hue >= HUE_MAX) ? HUE_MIN : new_hue + 1;
-		}
-		else
-		{
-			if (_r_sys_gettickcount () % 2)
-				new_hue = (INT)_r_math_rand (HUE_MIN, HUE_MAX);
-		}
+		hfile = GetStdHandle (STD_OUTPUT_HANDLE);
 	}
 	else
 	{
-		new_hue = config.hue;
+		ext = wcsrchr (path, L'.');
+
+		if (ext && _wcsicmp (ext, L".rgb") == 0)
+			format = VIDEO_FORMAT_RGB24;
+
+		hfile = CreateFile (path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
 	}
 
-	SetMatrixBitmap (hdc, matrix, new_hue);
+	if (!hfile || hfile == INVALID_HANDLE_VALUE)
+		return FALSE;
 
-	ReleaseDC (hwnd, hdc);
-}
+	// no window to take the dpi from
+	view = CreateMatrixView (width, height, config.cell_size);
 
-PMATRIX CreateMatrix (INT width, INT height)
-{
-	PMATRIX matrix;
-	INT numcols = width / GLYPH_WIDTH + 1;
-	INT numrows = height / GLYPH_HEIGHT + 1;
+	if (!view || !view->atlas)
+		goto CleanupExit;
 
-	matrix = _r_mem_allocatezero (sizeof (MATRIX) + (sizeof (MATRIX_COLUMN) * numcols));
+	view->matrix->framebuffer->dirty.limit = config.max_dirty_rects;
 
-	matrix->numcols = numcols;
-	matrix->numrows = numrows;
-	matrix->width = width;
-	matrix->height = height;
+	frame = _r_mem_allocatezero (VideoFrameSize (format, width, height));
+	buffer = _r_mem_allocatezero (VIDEO_BUFFER_DEFAULT);
 
-	for (INT x = 0; x < numcols; x++)
-	{
-		matrix->column[x].length = numrows;
-		matrix->column[x].countdown = _r_math_rand (0, RND_MAX) % 100;
-		matrix->column[x].state = _r_math_rand (0, RND_MAX) % 2;
-		matrix->column[x].run_length = _r_math_rand (0, RND_MAX) % 20 + 3;
+	if (!frame || !buffer)
+		goto CleanupExit;
 
-		matrix->column[x].glyph = _r_mem_allocatezero (sizeof (GLYPH) * (numrows + 16));
-	}
+	if (!VideoInit (&writer, format, width, height, 1000, MatrixStepTime (config.speed), frame, buffer, VIDEO_BUFFER_DEFAULT, &VideoFileSink, hfile))
+		goto CleanupExit;
 
-	HDC hdc = GetDC (NULL);
+	hue = config.hue;
 
-	if (hdc)
+	for (INT i = 0; i < frames; i++)
 	{
-		matrix->hdc = CreateCompatibleDC (hdc);
-		matrix->hbitmap = MakeBitmap (hdc, _r_sys_getimagebase (), IDR_GLYPH, config.hue);
+		RtlSecureZeroMemory (&job, sizeof (job));
 
-		SelectObject (matrix->hdc, matrix->hbitmap);
+		GetGlyphAtlas (view->atlas, &glyph_atlas);
 
-		ReleaseDC (NULL, hdc);
+		job.matrix = view->matrix;
+		job.atlas = &glyph_atlas;
+		job.steps = 1;
+		job.prewarm = view->prewarm;
+		job.decay = (config.phosphor > 0) ? config.phosphor : 0;
+
+		view->prewarm = 0;
+
+		RunWorkerPool (workers, (view->matrix->numcols + WORKER_CHUNK_COLUMNS - 1) / WORKER_CHUNK_COLUMNS, &UpdateMatrixChunk, &job);
+
+		BuildDirtyRegion (view->matrix);
+
+		if (job.decay)
+			AddDirtyRect (&view->matrix->framebuffer->dirty, 0, 0, view->matrix->width, view->matrix->height);
+
+		if (!VideoWriteFrame (&writer, view->matrix->framebuffer))
+			goto CleanupExit;
+
+		// random hues would not be reproducible, only the smooth cycle is kept
+		if (config.is_random && config.is_smooth)
+		{
+			hue = (hue >= HUE_MAX) ? HUE_MIN : hue + 1;
+
+			SetMatrixBitmap (NULL, view, hue);
+		}
 	}
 
-	return matrix;
+	is_success = VideoFlush (&writer);
+
+CleanupExit:
+
+	if (view)
+		DestroyMatrixView (view);
+
+	if (buffer)
+		_r_mem_free (buffer);
+
+	if (frame)
+		_r_mem_free (frame);
+
+	if (hfile != GetStdHandle (STD_OUTPUT_HANDLE))
+		CloseHandle (hfile);
+
+	return is_success;
 }
 
-VOID DestroyMatrix (PMATRIX matrix)
+typedef UINT (WINAPI *GDFW) (HWND hwnd);
+
+// GetDpiForWindow came with windows 10, older systems have one system dpi
+UINT GetWindowDpi (HWND hwnd)
 {
-	DeleteDC (matrix->hdc);
-	DeleteObject (matrix->hbitmap);
+	static GDFW get_dpi_for_window = NULL;
+	static BOOLEAN is_resolved = FALSE;
+	HDC hdc;
+	UINT dpi = 0;
 
-	for (INT x = 0; x < matrix->numcols; x++)
+	if (!is_resolved)
 	{
-		PGLYPH glyph = matrix->column[x].glyph;
+		get_dpi_for_window = (GDFW)GetProcAddress (GetModuleHandle (L"user32.dll"), "GetDpiForWindow");
+		is_resolved = TRUE;
+	}
 
-		if (glyph)
-		{
-			matrix->column[x].glyph = NULL;
+	if (get_dpi_for_window)
+		dpi = get_dpi_for_window (hwnd);
+
+	if (!dpi)
+	{
+		hdc = GetDC (hwnd);
 
-			_r_mem_free (glyph);
+		if (hdc)
+		{
+			dpi = (UINT)GetDeviceCaps (hdc, LOGPIXELSY);
+			ReleaseDC (hwnd, hdc);
 		}
 	}
 
-	_r_mem_free (matrix);
+	return dpi ? dpi : USER_DEFAULT_SCREEN_DPI;
+}
+
+// glyphs are as large as at 96 dpi, unless the size is set in the config
+INT GetCellSize (HWND hwnd)
+{
+	if (config.cell_size)
+		return MatrixCellSize (config.cell_size);
+
+	return MatrixCellSize (MulDiv (GLYPH_WIDTH, GetWindowDpi (hwnd), USER_DEFAULT_SCREEN_DPI));
+}
+
+// fullscreen windows cover their monitor, the resize follows with WM_SIZE
+VOID FitToMonitor (HWND hwnd)
+{
+	MONITORINFO monitor_info = {0};
+	HMONITOR hmonitor;
+
+	hmonitor = MonitorFromWindow (hwnd, MONITOR_DEFAULTTONEAREST);
+
+	monitor_info.cbSize = sizeof (monitor_info);
+
+	if (!GetMonitorInfo (hmonitor, &monitor_info))
+		return;
+
+	SetWindowPos (hwnd, NULL, monitor_info.rcMonitor.left, monitor_info.rcMonitor.top, _r_calc_rectwidth (&monitor_info.rcMonitor), _r_calc_rectheight (&monitor_info.rcMonitor), SWP_NOZORDER | SWP_NOOWNERZORDER | SWP_NOACTIVATE);
 }
 
 LRESULT CALLBACK ScreensaverProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
-	PMATRIX matrix;
+	PMATRIX_VIEW view;
 
 	static POINT pt_last = {0};
 	static POINT pt_cursor = {0};
@@ -417,28 +1974,37 @@ LRESULT CALLBACK ScreensaverProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpa
 			if (!config.hmatrix)
 				config.hmatrix = hwnd;
 
-			matrix = CreateMatrix (pcs->cx, pcs->cy);
+			view = CreateMatrixView (pcs->cx, pcs->cy, GetCellSize (hwnd));
+
+			if (!view)
+				return FALSE;
+
+			view->hwnd = hwnd;
 
-			if (!matrix)
+			// child windows get no power broadcasts, the settings dialog handles them
+			if (!pcs->hwndParent)
+				view->hpower = RegisterPowerSettingNotification (hwnd, &display_state_guid, DEVICE_NOTIFY_WINDOW_HANDLE);
+
+			if (!StartRenderThread (view))
+			{
+				DestroyMatrixView (view);
 				return FALSE;
+			}
 
-			SetWindowLongPtr (hwnd, GWLP_USERDATA, (LONG_PTR)matrix);
-			SetTimer (hwnd, UID, ((SPEED_MAX - config.speed) + SPEED_MIN) * 10, 0);
+			SetWindowLongPtr (hwnd, GWLP_USERDATA, (LONG_PTR)view);
 
 			return TRUE;
 		}
 
 		case WM_NCDESTROY:
 		{
-			KillTimer (hwnd, UID);
-
-			matrix = (PMATRIX)GetWindowLongPtr (hwnd, GWLP_USERDATA);
+			view = (PMATRIX_VIEW)GetWindowLongPtr (hwnd, GWLP_USERDATA);
 
-			if (matrix)
+			if (view)
 			{
 				SetWindowLongPtr (hwnd, GWLP_USERDATA, 0);
 
-				DestroyMatrix (matrix);
+				DestroyMatrixView (view);
 			}
 
 			if (config.is_preview && !GetParent (hwnd))
@@ -453,18 +2019,67 @@ LRESULT CALLBACK ScreensaverProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpa
 		{
 			config.hmatrix = NULL;
 
-			KillTimer (hwnd, UID);
+			view = (PMATRIX_VIEW)GetWindowLongPtr (hwnd, GWLP_USERDATA);
+
+			// no more frames into a window which is going away
+			if (view)
+				StopRenderThread (view);
+
 			DestroyWindow (hwnd);
 
 			return FALSE;
 		}
 
-		case WM_TIMER:
+		case WM_PAINT:
+		{
+			PAINTSTRUCT ps;
+
+			view = (PMATRIX_VIEW)GetWindowLongPtr (hwnd, GWLP_USERDATA);
+
+			BeginPaint (hwnd, &ps);
+
+			// the back-buffer belongs to the render thread, which
+			// presents the whole frame with its next tick
+			if (view)
+				InterlockedExchange (&view->is_invalid, TRUE);
+
+			EndPaint (hwnd, &ps);
+
+			return FALSE;
+		}
+
+		case WM_POWERBROADCAST:
+		{
+			HandlePowerBroadcast (wparam, lparam);
+			return TRUE;
+		}
+
+		case WM_SIZE:
+		{
+			view = (PMATRIX_VIEW)GetWindowLongPtr (hwnd, GWLP_USERDATA);
+
+			// the grid is kept while minimized
+			if (view && wparam != SIZE_MINIMIZED && LOWORD (lparam) && HIWORD (lparam))
+				InterlockedExchange64 (&view->resize, ((LONG64)LOWORD (lparam) << 32) | HIWORD (lparam));
+
+			break;
+		}
+
+		case WM_DPICHANGED:
 		{
-			matrix = (PMATRIX)GetWindowLongPtr (hwnd, GWLP_USERDATA);
+			view = (PMATRIX_VIEW)GetWindowLongPtr (hwnd, GWLP_USERDATA);
+
+			// the glyphs follow the dpi unless the size is fixed
+			if (view && !config.cell_size)
+				InterlockedExchange (&view->cell_size, MatrixCellSize (MulDiv (GLYPH_WIDTH, HIWORD (wparam), USER_DEFAULT_SCREEN_DPI)));
 
-			if (matrix)
-				DecodeMatrix (hwnd, matrix);
+			// fall through
+		}
+
+		case WM_DISPLAYCHANGE:
+		{
+			if (!GetParent (hwnd))
+				FitToMonitor (hwnd);
 
 			return FALSE;
 		}
@@ -472,6 +2087,12 @@ LRESULT CALLBACK ScreensaverProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpa
 		case WM_KEYDOWN:
 		case WM_SYSKEYDOWN:
 		{
+			if (wparam == STATS_HOTKEY)
+			{
+				config.is_stats = !config.is_stats;
+				return FALSE;
+			}
+
 			if (wparam != VK_ESCAPE && config.is_esc_only)
 				return FALSE;
 
@@ -558,19 +2179,22 @@ VOID StartScreensaver (HWND hparent)
 
 INT_PTR CALLBACK SettingsProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
+	static HPOWERNOTIFY hpower = NULL;
+
 	switch (msg)
 	{
 		case WM_INITDIALOG:
 		{
 			HWND hpreview = GetDlgItem (hwnd, IDC_PREVIEW);
+			INT glyphs = GetGlyphLimit ();
 
 			// localize window
-			_r_ctrl_settextformat (hwnd, IDC_AMOUNT_RANGE, L"%d-%d", AMOUNT_MIN, AMOUNT_MAX);
+			_r_ctrl_settextformat (hwnd, IDC_AMOUNT_RANGE, L"%d-%d", AMOUNT_MIN, glyphs);
 			_r_ctrl_settextformat (hwnd, IDC_DENSITY_RANGE, L"%d-%d", DENSITY_MIN, DENSITY_MAX);
 			_r_ctrl_settextformat (hwnd, IDC_SPEED_RANGE, L"%d-%d", SPEED_MIN, SPEED_MAX);
 			_r_ctrl_settextformat (hwnd, IDC_HUE_RANGE, L"%d-%d", HUE_MIN, HUE_MAX);
 
-			SendDlgItemMessage (hwnd, IDC_AMOUNT, UDM_SETRANGE32, AMOUNT_MIN, AMOUNT_MAX);
+			SendDlgItemMessage (hwnd, IDC_AMOUNT, UDM_SETRANGE32, AMOUNT_MIN, glyphs);
 			SendDlgItemMessage (hwnd, IDC_AMOUNT, UDM_SETPOS32, 0, (LPARAM)config.amount);
 
 			SendDlgItemMessage (hwnd, IDC_DENSITY, UDM_SETRANGE32, DENSITY_MIN, DENSITY_MAX);
@@ -597,11 +2221,19 @@ INT_PTR CALLBACK SettingsProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam
 			_r_wnd_addstyle (hwnd, IDC_RESET, is_classic ? WS_EX_STATICEDGE : 0, WS_EX_STATICEDGE, GWL_EXSTYLE);
 			_r_wnd_addstyle (hwnd, IDC_CLOSE, is_classic ? WS_EX_STATICEDGE : 0, WS_EX_STATICEDGE, GWL_EXSTYLE);
 
+			hpower = RegisterPowerSettingNotification (hwnd, &display_state_guid, DEVICE_NOTIFY_WINDOW_HANDLE);
+
 			StartScreensaver (hpreview);
 
 			break;
 		}
 
+		case WM_POWERBROADCAST:
+		{
+			HandlePowerBroadcast (wparam, lparam);
+			break;
+		}
+
 		case WM_NCCREATE:
 		{
 			_r_wnd_enablenonclientscaling (hwnd);
@@ -616,6 +2248,12 @@ INT_PTR CALLBACK SettingsProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam
 
 		case WM_DESTROY:
 		{
+			if (hpower)
+			{
+				UnregisterPowerSettingNotification (hpower);
+				hpower = NULL;
+			}
+
 			SaveSettings ();
 			PostQuitMessage (0);
 
@@ -723,8 +2361,7 @@ INT_PTR CALLBACK SettingsProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam
 					SendDlgItemMessage (hwnd, IDC_SPEED, UDM_SETPOS32, 0, SPEED_DEFAULT);
 					SendDlgItemMessage (hwnd, IDC_HUE, UDM_SETPOS32, 0, HUE_DEFAULT);
 
-					KillTimer (config.hmatrix, UID);
-					SetTimer (config.hmatrix, UID, ((SPEED_MAX - SPEED_DEFAULT) + SPEED_MIN) * 10, 0);
+					config.speed = SPEED_DEFAULT;
 
 					PostMessage (hwnd, WM_COMMAND, MAKEWPARAM (IDC_RANDOMIZECOLORS_CHK, 0), 0);
 					PostMessage (hwnd, WM_COMMAND, MAKEWPARAM (IDC_ISCLOSEONESC_CHK, 0), 0);
@@ -775,13 +2412,7 @@ INT_PTR CALLBACK SettingsProc (HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam
 
 				case IDC_SPEED_CTRL:
 				{
-					INT new_value = (INT)SendDlgItemMessage (hwnd, IDC_SPEED, UDM_GETPOS32, 0, 0);
-
-					KillTimer (config.hmatrix, UID);
-					SetTimer (config.hmatrix, UID, ((SPEED_MAX - new_value) + SPEED_MIN) * 10, 0);
-
-					config.speed = new_value;
-
+					config.speed = (INT)SendDlgItemMessage (hwnd, IDC_SPEED, UDM_GETPOS32, 0, 0);
 					break;
 				}
 
@@ -834,7 +2465,7 @@ BOOLEAN RegisterClasses (HINSTANCE hinst)
 	wcex.style = CS_VREDRAW | CS_HREDRAW | CS_SAVEBITS | CS_PARENTDC;
 	wcex.lpfnWndProc = &ScreensaverProc;
 	wcex.hbrBackground = CreateSolidBrush (RGB (0, 0, 0));
-	wcex.cbWndExtra = sizeof (PMATRIX);
+	wcex.cbWndExtra = sizeof (PMATRIX_VIEW);
 
 	wcex.lpszClassName = CLASS_PREVIEW;
 	wcex.hCursor = LoadCursor (NULL, IDC_ARROW);
@@ -860,6 +2491,9 @@ BOOLEAN RegisterClasses (HINSTANCE hinst)
 INT APIENTRY wWinMain (_In_ HINSTANCE hinst, _In_opt_ HINSTANCE prev_hinst, _In_ LPWSTR cmdline, _In_ INT show_cmd)
 {
 	MSG msg;
+	INT status = ERROR_SUCCESS;
+
+	startup.start = GetClockTime ();
 
 	RtlSecureZeroMemory (&config, sizeof (config));
 
@@ -869,24 +2503,41 @@ INT APIENTRY wWinMain (_In_ HINSTANCE hinst, _In_opt_ HINSTANCE prev_hinst, _In_
 	// read settings
 	ReadSettings ();
 
+	UpdateBatteryState ();
+
 	// register classes
 	if (!RegisterClasses (hinst))
 		goto CleanupExit;
 
+	workers = CreateWorkerPool (config.threads);
+
 	// parse arguments
 	if (_r_str_compare_length (cmdline, L"/s", 2) == 0)
 	{
+		startup.mode = "/s";
+
 		StartScreensaver (NULL);
 	}
 	else if (_r_str_compare_length (cmdline, L"/p", 2) == 0)
 	{
 		HWND hctrl = (HWND)_r_str_tolong64 (cmdline + 3);
 
+		startup.mode = "/p";
+
 		if (hctrl)
 			StartScreensaver (hctrl);
 	}
+	else if (_r_str_compare_length (cmdline, L"/v", 2) == 0)
+	{
+		if (!RenderVideo (cmdline + 2))
+			status = ERROR_WRITE_FAULT;
+
+		goto CleanupExit;
+	}
 	else
 	{
+		startup.mode = "settings";
+
 		config.is_preview = TRUE;
 
 		if (!_r_app_createwindow (IDD_SETTINGS, IDI_MAIN, &SettingsProc))
@@ -906,8 +2557,12 @@ INT APIENTRY wWinMain (_In_ HINSTANCE hinst, _In_opt_ HINSTANCE prev_hinst, _In_
 
 CleanupExit:
 
+	DestroyWorkerPool (workers);
+
+	DestroyAtlasCache ();
+
 	UnregisterClass (CLASS_PREVIEW, hinst);
 	UnregisterClass (CLASS_FULLSCREEN, hinst);
 
-	return ERROR_SUCCESS;
+	return status;
 }
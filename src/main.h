@@ -6,30 +6,34 @@
 
 #include "routine.h"
 
+#include <dwmapi.h>
+#include <stdio.h>
+
 #include "resource.h"
 #include "app.h"
+#include "workers.h"
 
-// config
-#define UID 0xDEADBEEF
+#include "core/atlas.h"
+#include "core/governor.h"
+#include "core/matrix.h"
+#include "core/overlay.h"
+#include "core/phosphor.h"
+#include "core/recolor.h"
+#include "core/render.h"
+#include "core/scale.h"
+#include "core/schedule.h"
+#include "core/stats.h"
+#include "core/video.h"
 
-#define CLASS_FULLSCREEN APP_NAME_SHORT L"_Fullscreen"
-#define CLASS_PREVIEW APP_NAME_SHORT L"_Preview"
+#pragma comment(lib, "dwmapi.lib")
 
-#define GLYPH_REDRAW 0x8000
-#define GLYPH_BLANK 0x4000
-#define RND_MASK 0xB400
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
 
-#define AMOUNT_MIN 1
-#define AMOUNT_MAX 26
-#define AMOUNT_DEFAULT 26
-
-#define DENSITY_MIN 5
-#define DENSITY_MAX 50
-#define DENSITY_DEFAULT 30
-
-#define SPEED_MIN 1
-#define SPEED_MAX 10
-#define SPEED_DEFAULT 6
+// config
+#define CLASS_FULLSCREEN APP_NAME_SHORT L"_Fullscreen"
+#define CLASS_PREVIEW APP_NAME_SHORT L"_Preview"
 
 #define HUE_MIN 1
 #define HUE_MAX 255
@@ -38,10 +42,44 @@
 #define HUE_RANDOM FALSE
 #define HUE_RANDOM_SMOOTHTRANSITION TRUE
 
-// constants inferred from matrix.bmp
-#define MAX_INTENSITY 5 // number of intensity levels
-#define GLYPH_WIDTH 14 // width of each glyph (pixels)
-#define GLYPH_HEIGHT 14 // height of each glyph (pixels)
+// toggles the frame time overlay
+#define STATS_HOTKEY VK_F2
+
+// frame rate cap while running on battery, zero disables it
+#define BATTERY_FPS_MAX 60
+#define BATTERY_FPS_DEFAULT 10
+
+// brightness trails keep per frame in 1/256, zero draws no trails
+#define PHOSPHOR_DEFAULT 0
+
+// how often suspended views check whether they got visible again
+#define VISIBILITY_POLL_MS 250
+
+// number of hue-tinted glyph atlases kept alive
+#define ATLAS_CACHE_MAX 64
+
+// heap bytes of the atlases kept alive, those in use may go past it
+#define ATLAS_CACHE_BYTES (128 * 1024 * 1024)
+
+// hues of a font atlas kept alive per cell size, a font range makes
+// atlases of many megabytes
+#define ATLAS_FONT_HUES_MAX 4
+
+// number of cell sizes with scaled glyph planes kept alive
+#define ATLAS_PLANES_MAX 8
+
+// bytes of the glyph planes kept alive, the planes being built may go past it
+#define ATLAS_PLANES_BYTES (64 * 1024 * 1024)
+
+// glyphs of the stock glyph.bmp, for when neither atlas can be loaded
+#define GLYPH_BITMAP_GLYPHS 26
+
+// glyphs in a band of a font atlas, see GLYPH_ATLAS
+#define FONT_ATLAS_COLUMNS 64
+
+// character range of font glyphs, katakana by default
+#define FONT_FIRST_DEFAULT 0x30A0
+#define FONT_LAST_DEFAULT 0x30FF
 
 typedef struct _STATIC_DATA
 {
@@ -50,45 +88,169 @@ typedef struct _STATIC_DATA
 	INT density;
 	INT speed;
 	INT hue;
+	INT max_dirty_rects;
+	INT seed; // zero for a random seed
+	INT threads; // zero for one per physical core
+	INT max_catchup; // simulation steps run at most per presented frame
+	INT battery_fps; // zero to run at full rate on battery
+	INT cell_size; // zero to scale the glyphs with the dpi
+	INT quality; // level of optional work, see governor.h
+	INT quality_floor; // lowest level the governor may drop to
+	INT phosphor; // brightness trails keep per frame, zero for none
+	INT font_first; // first and last character of the font glyphs
+	INT font_last;
+	WCHAR font[LF_FACESIZE]; // empty for the glyph bitmap
+	volatile LONG is_battery;
+	volatile LONG is_display_off;
 	BOOLEAN is_esc_only;
 	BOOLEAN is_random;
 	BOOLEAN is_smooth;
 	BOOLEAN is_preview;
+	BOOLEAN is_vsync; // present on dwm composition instead of a timer
+	BOOLEAN is_stats; // frame time overlay
+	BOOLEAN is_prewarm; // new views start with a full screen
 } STATIC_DATA, *PSTATIC_DATA;
 
-typedef UINT GLYPH;
-typedef PUINT PGLYPH;
-
 //
-//	The "matrix" is basically an array of these
-//  column structures, positioned side-by-side
+//	Glyph bitmap recolored to a single hue and scaled to a single
+//	cell size, shared between all matrices which are currently
+//	using that hue and size
 //
-typedef struct _MATRIX_COLUMN
+typedef struct _ATLAS
 {
-	PGLYPH glyph;
+	PULONG bits;
+	SIZE_T capacity; // in pixels
 
-	INT state;
-	INT countdown;
+	ULONG last_used;
+	LONG ref_count;
 
-	INT blip_pos;
-	INT blip_length;
+	// mapped atlas cache file the bits point into, nothing to free
+	PVOID view;
 
-	INT length;
-	INT run_length;
+	INT hue;
+	INT cell_size;
+} ATLAS, *PATLAS;
+
+// saturation and luminance planes of the glyphs at one cell size
+typedef struct _ATLAS_PLANES
+{
+	PBYTE saturation;
+	PBYTE luminance;
+
+	ULONG last_used;
 
-	BOOLEAN is_started;
-} MATRIX_COLUMN, *PMATRIX_COLUMN;
+	// cache files being written from the planes, they are not evicted
+	LONG ref_count;
 
-typedef struct _MATRIX
+	INT cell_size;
+} ATLAS_PLANES, *PATLAS_PLANES;
+
+typedef struct _ATLAS_CACHE
 {
+	// render threads share the cache
+	SRWLOCK lock;
+
+	// glyphs in the source bitmap or the font atlas
+	INT columns;
+	INT rows;
+
+	// glyphs of the atlases handed out, the amount never goes past them
+	volatile LONG glyphs;
+
+	ULONG clock;
+	INT count;
+	INT planes_count;
+
+	// baked atlas from the resources, no pixels when it is missing
+	ATLAS_IMAGE image;
+
+	//
+	// glyphs of a font are shaded with the tones of the baked atlas and
+	// rasterized at every cell size instead of being scaled. atlases of
+	// the configured hue go to a cache file, later starts map it.
+	//
+	BOOLEAN is_font;
+	INT font_glyphs;
+	UINT64 font_key; // everything but the hue and the cell size
+	ATLAS_TONE tone[ATLAS_LEVELS];
+	WCHAR cache_path[MAX_PATH];
+
+	// the first planes are the source bitmap at GLYPH_WIDTH, top-down,
+	// unless the glyphs come from a font
+	ATLAS_PLANES planes[ATLAS_PLANES_MAX];
+	ATLAS atlas[ATLAS_CACHE_MAX];
+} ATLAS_CACHE, *PATLAS_CACHE;
+
+//
+//	Startup latency, traced with OutputDebugString once the first frame
+//	is shown. The control panel starts a new process for every preview,
+//	so this is what the user waits for.
+//
+typedef struct _STARTUP_TRACE
+{
+	LPCSTR mode;
+
+	LONG64 start; // performance counter at wWinMain
+	LONG64 atlas; // spent on the first atlas
+
+	volatile LONG is_done;
+} STARTUP_TRACE, *PSTARTUP_TRACE;
+
+//
+//	Per-window state, wraps the platform independent
+//	simulation with the gdi resources used to draw it
+//
+typedef struct _MATRIX_VIEW
+{
+	HWND hwnd;
+
+	PMATRIX matrix;
+
 	// bitmap containing glyphs.
-	HDC hdc;
-	HBITMAP hbitmap;
+	PATLAS atlas;
+
+	// region buffer for presenting dirty rectangles
+	PRGNDATA rgndata;
+
+	// frames are simulated and presented on their own thread,
+	// the window thread only handles input and close
+	HANDLE hthread;
+	HANDLE hstop;
+
+	// display state notifications, top-level windows only
+	HPOWERNOTIFY hpower;
+
+	// set by WM_PAINT, the next frame is presented in full
+	volatile LONG is_invalid;
+
+	// client size (width << 32 | height) waiting for the render thread
+	volatile LONG64 resize;
 
-	INT width;
-	INT height;
-	INT numcols;
-	INT numrows;
+	// cell size for the dpi of the window, applied along with a resize
+	volatile LONG cell_size;
+
+	// ticks fast-forwarded before the next frame, see PrewarmMatrixColumns
+	INT prewarm;
+
+	INT hue; // hue of the next frame
+
+	// always collected, only drawn when the overlay is enabled
+	FRAME_STATS stats;
+
+	// scales back optional work when frames take too long
+	FRAME_GOVERNOR governor;
+} MATRIX_VIEW, *PMATRIX_VIEW;
+
+// one frame of work, handed to the worker pool in column chunks
+typedef struct _MATRIX_JOB
+{
+	PMATRIX matrix;
+	const GLYPH_ATLAS *atlas; // null when nothing is drawn
+	INT steps; // simulation steps before drawing
+	INT prewarm; // ticks fast-forwarded before the steps, nothing is flagged for them
+	INT decay; // the framebuffer fades instead of redrawing, see DrawPhosphorColumns
 
-	MATRIX_COLUMN column[1];
-} MATRIX, *PMATRIX;
+	// summed up over every chunk
+	volatile LONG64 phase[FRAME_PHASE_DRAW + 1];
+	volatile LONG cells;
+} MATRIX_JOB, *PMATRIX_JOB;
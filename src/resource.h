@@ -37,6 +37,9 @@
 // Cursors
 #define IDR_CURSOR 2
 
+// Raw data
+#define IDR_ATLAS 3
+
 // Icons
 #define IDI_MAIN 100
 
@@ -0,0 +1,192 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#include "routine.h"
+
+#include "workers.h"
+
+INT GetPhysicalCoreCount ()
+{
+	PSYSTEM_LOGICAL_PROCESSOR_INFORMATION buffer;
+	ULONG length = 0;
+	INT count = 0;
+
+	GetLogicalProcessorInformation (NULL, &length);
+
+	if (!length)
+		return 1;
+
+	buffer = _r_mem_allocatezero (length);
+
+	if (GetLogicalProcessorInformation (buffer, &length))
+	{
+		for (SIZE_T i = 0; i < length / sizeof (SYSTEM_LOGICAL_PROCESSOR_INFORMATION); i++)
+		{
+			if (buffer[i].Relationship == RelationProcessorCore)
+				count += 1;
+		}
+	}
+
+	_r_mem_free (buffer);
+
+	return count ? count : 1;
+}
+
+static VOID RunWorkerQueues (PWORKER_POOL pool, INT index)
+{
+	PWORKER_QUEUE queue;
+	LONG chunk;
+
+	// own chunks first, then steal from the others
+	for (INT i = 0; i < pool->count; i++)
+	{
+		queue = &pool->queues[(index + i) % pool->count];
+
+		while ((chunk = InterlockedIncrement (&queue->next) - 1) < queue->end)
+			pool->routine (pool->context, chunk);
+	}
+}
+
+static ULONG WINAPI WorkerThreadProc (PVOID lparam)
+{
+	PWORKER_THREAD thread = lparam;
+	PWORKER_POOL pool = thread->pool;
+	ULONG generation = 0;
+	BOOLEAN is_shutdown;
+
+	while (TRUE)
+	{
+		AcquireSRWLockExclusive (&pool->lock);
+
+		while (pool->generation == generation && !pool->is_shutdown)
+			SleepConditionVariableSRW (&pool->wake, &pool->lock, INFINITE, 0);
+
+		generation = pool->generation;
+		is_shutdown = pool->is_shutdown;
+
+		ReleaseSRWLockExclusive (&pool->lock);
+
+		if (is_shutdown)
+			break;
+
+		RunWorkerQueues (pool, thread->index);
+
+		if (InterlockedDecrement (&pool->pending) == 0)
+			SetEvent (pool->hdone);
+	}
+
+	return ERROR_SUCCESS;
+}
+
+PWORKER_POOL CreateWorkerPool (INT count)
+{
+	PWORKER_POOL pool;
+
+	if (count <= 0)
+		count = GetPhysicalCoreCount ();
+
+	if (count > WORKERS_MAX)
+		count = WORKERS_MAX;
+
+	if (count <= 1)
+		return NULL;
+
+	pool = _r_mem_allocatezero (sizeof (WORKER_POOL));
+
+	InitializeSRWLock (&pool->run_lock);
+	InitializeSRWLock (&pool->lock);
+	InitializeConditionVariable (&pool->wake);
+
+	pool->hdone = CreateEvent (NULL, FALSE, FALSE, NULL);
+
+	if (!pool->hdone)
+	{
+		_r_mem_free (pool);
+		return NULL;
+	}
+
+	pool->queues = _r_mem_allocatezero (sizeof (WORKER_QUEUE) * count);
+	pool->threads = _r_mem_allocatezero (sizeof (WORKER_THREAD) * count);
+
+	pool->count = 1;
+
+	// slot zero belongs to the calling thread
+	for (INT i = 1; i < count; i++)
+	{
+		pool->threads[i].pool = pool;
+		pool->threads[i].index = i;
+
+		pool->threads[i].hthread = CreateThread (NULL, 0, &WorkerThreadProc, &pool->threads[i], 0, NULL);
+
+		if (!pool->threads[i].hthread)
+			break;
+
+		pool->count += 1;
+	}
+
+	if (pool->count <= 1)
+	{
+		DestroyWorkerPool (pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+VOID DestroyWorkerPool (PWORKER_POOL pool)
+{
+	if (!pool)
+		return;
+
+	AcquireSRWLockExclusive (&pool->lock);
+	pool->is_shutdown = TRUE;
+	ReleaseSRWLockExclusive (&pool->lock);
+
+	WakeAllConditionVariable (&pool->wake);
+
+	for (INT i = 1; i < pool->count; i++)
+	{
+		WaitForSingleObject (pool->threads[i].hthread, INFINITE);
+		CloseHandle (pool->threads[i].hthread);
+	}
+
+	CloseHandle (pool->hdone);
+
+	_r_mem_free (pool->queues);
+	_r_mem_free (pool->threads);
+	_r_mem_free (pool);
+}
+
+VOID RunWorkerPool (PWORKER_POOL pool, INT chunks, PWORKER_ROUTINE routine, PVOID context)
+{
+	if (!pool || chunks <= 1 || !TryAcquireSRWLockExclusive (&pool->run_lock))
+	{
+		for (INT i = 0; i < chunks; i++)
+			routine (context, i);
+
+		return;
+	}
+
+	for (INT i = 0; i < pool->count; i++)
+	{
+		pool->queues[i].next = (LONG)((LONG64)chunks * i / pool->count);
+		pool->queues[i].end = (LONG)((LONG64)chunks * (i + 1) / pool->count);
+	}
+
+	pool->routine = routine;
+	pool->context = context;
+	pool->pending = pool->count - 1;
+
+	AcquireSRWLockExclusive (&pool->lock);
+	pool->generation += 1;
+	ReleaseSRWLockExclusive (&pool->lock);
+
+	WakeAllConditionVariable (&pool->wake);
+
+	RunWorkerQueues (pool, 0);
+
+	// barrier, every thread is done with this job
+	WaitForSingleObject (pool->hdone, INFINITE);
+
+	ReleaseSRWLockExclusive (&pool->run_lock);
+}
@@ -0,0 +1,69 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+
+#pragma once
+
+#include "routine.h"
+
+#define WORKERS_MAX 64
+#define WORKERS_DEFAULT 0 // one per physical core
+
+// columns per chunk, a multiple of the widest scroll kernel
+#define WORKER_CHUNK_COLUMNS 32
+
+typedef VOID (NTAPI *PWORKER_ROUTINE) (PVOID context, INT chunk);
+
+//
+//	Chunks of a job are split evenly between the threads up front,
+//	a thread which runs out of its own chunks steals the remaining
+//	ones of the others. Cache line sized to avoid false sharing.
+//
+typedef struct _WORKER_QUEUE
+{
+	volatile LONG next;
+	LONG end;
+
+	BYTE padding[64 - (sizeof (LONG) * 2)];
+} WORKER_QUEUE, *PWORKER_QUEUE;
+
+typedef struct _WORKER_THREAD
+{
+	struct _WORKER_POOL *pool;
+	HANDLE hthread;
+	INT index;
+} WORKER_THREAD, *PWORKER_THREAD;
+
+typedef struct _WORKER_POOL
+{
+	// one job at a time, other callers run their chunks inline
+	SRWLOCK run_lock;
+
+	SRWLOCK lock;
+	CONDITION_VARIABLE wake;
+
+	// signaled when the last thread finished the current job
+	HANDLE hdone;
+
+	PWORKER_ROUTINE routine;
+	PVOID context;
+
+	volatile LONG pending;
+
+	ULONG generation;
+	BOOLEAN is_shutdown;
+
+	// the calling thread is counted as well
+	INT count;
+
+	PWORKER_QUEUE queues;
+	PWORKER_THREAD threads;
+} WORKER_POOL, *PWORKER_POOL;
+
+INT GetPhysicalCoreCount ();
+
+// zero threads uses one per physical core, returns null when single threaded
+PWORKER_POOL CreateWorkerPool (INT count);
+VOID DestroyWorkerPool (PWORKER_POOL pool);
+
+// run the routine for every chunk and wait for all of them, the pool may be null
+VOID RunWorkerPool (PWORKER_POOL pool, INT chunks, PWORKER_ROUTINE routine, PVOID context);
@@ -0,0 +1,147 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+//
+// Bakes the glyph bitmap into the atlas the screensaver embeds, so the
+// default atlas is ready without decoding or recoloring at startup.
+//
+//	matrix_bake [--hue N] INPUT OUTPUT
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/atlas.h"
+#include "core/matrix.h"
+
+// HUE_DEFAULT of the screensaver, other hues are recolored at runtime
+#define BAKE_HUE_DEFAULT 85
+
+static uint8_t *ReadFileData (const char *path, size_t *size)
+{
+	uint8_t *data = NULL;
+	long length;
+	FILE *file;
+
+	file = fopen (path, "rb");
+
+	if (!file)
+		return NULL;
+
+	if (!fseek (file, 0, SEEK_END) && (length = ftell (file)) >= 0 && !fseek (file, 0, SEEK_SET))
+	{
+		*size = (size_t)length;
+		data = malloc (*size ? *size : 1);
+
+		if (data && fread (data, 1, *size, file) != *size)
+		{
+			free (data);
+			data = NULL;
+		}
+	}
+
+	fclose (file);
+
+	return data;
+}
+
+int main (int argc, char **argv)
+{
+	const char *input = NULL;
+	const char *output = NULL;
+	uint8_t *data;
+	uint8_t *planes = NULL;
+	uint8_t *baked = NULL;
+	ATLAS_IMAGE image = {0};
+	size_t size;
+	size_t count;
+	int hue = BAKE_HUE_DEFAULT;
+	int columns;
+	int rows;
+	int status = 1;
+	FILE *file;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp (argv[i], "--hue") && i + 1 < argc)
+		{
+			hue = atoi (argv[++i]);
+		}
+		else if (!input)
+		{
+			input = argv[i];
+		}
+		else if (!output)
+		{
+			output = argv[i];
+		}
+		else
+		{
+			input = NULL;
+			break;
+		}
+	}
+
+	if (!input || !output || hue < 0)
+	{
+		fprintf (stderr, "usage: %s [--hue N] INPUT OUTPUT\n", argv[0]);
+		return 2;
+	}
+
+	data = ReadFileData (input, &size);
+
+	if (!data || !GlyphBitmapSize (data, size, &columns, &rows))
+	{
+		fprintf (stderr, "cannot load %s\n", input);
+		free (data);
+
+		return 1;
+	}
+
+	count = (size_t)columns * GLYPH_WIDTH * rows * GLYPH_HEIGHT;
+	size = AtlasImageSize (columns, rows, GLYPH_WIDTH, GLYPH_HEIGHT);
+
+	planes = malloc (count * 2);
+	baked = malloc (size);
+
+	if (!planes || !baked)
+		goto CleanupExit;
+
+	DecodeGlyphBitmap (data, planes, planes + count);
+
+	image.saturation = planes;
+	image.luminance = planes + count;
+
+	image.columns = columns;
+	image.rows = rows;
+	image.cell_width = GLYPH_WIDTH;
+	image.cell_height = GLYPH_HEIGHT;
+	image.hue = hue;
+
+	BakeAtlasImage (baked, &image);
+
+	file = fopen (output, "wb");
+
+	if (!file)
+	{
+		fprintf (stderr, "cannot create %s\n", output);
+		goto CleanupExit;
+	}
+
+	if (fwrite (baked, 1, size, file) == size)
+		status = 0;
+
+	if (fclose (file))
+		status = 1;
+
+	if (status)
+		fprintf (stderr, "cannot write %s\n", output);
+
+CleanupExit:
+
+	free (baked);
+	free (planes);
+	free (data);
+
+	return status;
+}
@@ -0,0 +1,374 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+//
+// Headless benchmark of the simulation and the compositor, prints
+// one json object with the results of every scenario.
+//
+//	matrix_bench [--ticks N] [--warmup N] [--seed N] [--filter TEXT]
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/cpu.h"
+#include "core/matrix.h"
+#include "core/phosphor.h"
+#include "core/recolor.h"
+#include "core/render.h"
+#include "core/scale.h"
+
+#define ATLAS_COLUMNS AMOUNT_DEFAULT // glyphs of glyph.bmp
+#define ATLAS_WIDTH (ATLAS_COLUMNS * GLYPH_WIDTH)
+#define ATLAS_HEIGHT ((MAX_INTENSITY + 1) * GLYPH_HEIGHT)
+#define ATLAS_ROWS (MAX_INTENSITY + 1)
+
+typedef struct _BENCH_SCENARIO
+{
+	const char *name;
+
+	int width;
+	int height;
+	int amount;
+	int density;
+	int speed;
+	int cell_size; // zero for the default
+	int phosphor; // decay of the trails, zero for none
+} BENCH_SCENARIO, *PBENCH_SCENARIO;
+
+typedef struct _BENCH_OPTIONS
+{
+	int ticks;
+	int warmup;
+	uint64_t seed;
+	const char *filter;
+} BENCH_OPTIONS, *PBENCH_OPTIONS;
+
+typedef struct _BENCH_ALLOCATOR
+{
+	size_t count;
+	size_t bytes;
+} BENCH_ALLOCATOR, *PBENCH_ALLOCATOR;
+
+//
+//	The settings dialog preview is 364x100 dialog units, about 546x163
+//	pixels with the default dialog font at 96 dpi.
+//
+static const BENCH_SCENARIO scenarios[] = {
+	{"preview", 546, 163, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"720p", 1280, 720, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"1080p", 1920, 1080, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"1440p", 2560, 1440, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"4k", 3840, 2160, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"3x4k", 11520, 2160, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"8k", 7680, 4320, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+
+	{"1080p-amount-1", 1920, 1080, AMOUNT_MIN, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+	{"1080p-amount-13", 1920, 1080, 13, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 0},
+
+	{"1080p-density-5", 1920, 1080, AMOUNT_DEFAULT, DENSITY_MIN, SPEED_DEFAULT, 0, 0},
+	{"1080p-density-15", 1920, 1080, AMOUNT_DEFAULT, 15, SPEED_DEFAULT, 0, 0},
+	{"1080p-density-50", 1920, 1080, AMOUNT_DEFAULT, DENSITY_MAX, SPEED_DEFAULT, 0, 0},
+
+	{"1080p-speed-1", 1920, 1080, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_MIN, 0, 0},
+	{"1080p-speed-10", 1920, 1080, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_MAX, 0, 0},
+	{"8k-speed-10", 7680, 4320, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_MAX, 0, 0},
+
+	// cells scaled with the dpi, 150% to 400%
+	{"1440p-cell-21", 2560, 1440, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 21, 0},
+	{"4k-cell-28", 3840, 2160, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 28, 0},
+	{"8k-cell-56", 7680, 4320, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 56, 0},
+
+	// the whole framebuffer fades every frame
+	{"1080p-phosphor", 1920, 1080, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 230},
+	{"4k-phosphor", 3840, 2160, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 230},
+	{"8k-phosphor", 7680, 4320, AMOUNT_DEFAULT, DENSITY_DEFAULT, SPEED_DEFAULT, 0, 230},
+};
+
+static void *BenchAllocate (void *context, size_t size)
+{
+	PBENCH_ALLOCATOR allocator = context;
+
+	allocator->count += 1;
+	allocator->bytes += size;
+
+	return calloc (1, size);
+}
+
+static void BenchFree (void *context, void *ptr)
+{
+	(void)context;
+
+	free (ptr);
+}
+
+static double BenchTime (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+//
+//	Deterministic stand-in for glyph.bmp, the compositor cost does not
+//	depend on the glyph shapes, only on the atlas layout. The planes get
+//	scaled to the cell size the same way the screensaver does it.
+//
+static uint32_t *BenchCreateAtlas (PGLYPH_ATLAS atlas, int cell_size)
+{
+	size_t count = (size_t)ATLAS_WIDTH * ATLAS_HEIGHT;
+	size_t scaled_count = (size_t)ATLAS_COLUMNS * cell_size * ATLAS_ROWS * cell_size;
+	uint8_t *planes = malloc (count * 2);
+	uint8_t *scaled = malloc (scaled_count * 2);
+	uint8_t *temp = malloc (ScaleCellsTempSize (ATLAS_COLUMNS, ATLAS_ROWS, GLYPH_HEIGHT, cell_size));
+	uint32_t *pixels = malloc (scaled_count * sizeof (uint32_t));
+	RNG_STREAM rng;
+
+	if (!planes || !scaled || !temp || !pixels)
+		goto CleanupExit;
+
+	RngSeed (&rng, 1, 0);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		planes[i] = (uint8_t)RngRange (&rng, HLS_MAX + 1);
+		planes[count + i] = (uint8_t)RngRange (&rng, HLS_MAX + 1);
+	}
+
+	if (!ScaleCells (scaled, planes, temp, ATLAS_COLUMNS, ATLAS_ROWS, GLYPH_WIDTH, GLYPH_HEIGHT, cell_size, cell_size) ||
+		!ScaleCells (scaled + scaled_count, planes + count, temp, ATLAS_COLUMNS, ATLAS_ROWS, GLYPH_WIDTH, GLYPH_HEIGHT, cell_size, cell_size))
+	{
+		goto CleanupExit;
+	}
+
+	RecolorPixels (pixels, scaled, scaled + scaled_count, scaled_count, 85);
+
+	free (planes);
+	free (scaled);
+	free (temp);
+
+	atlas->pixels = pixels;
+	atlas->stride = (ptrdiff_t)ATLAS_COLUMNS * cell_size;
+	atlas->width = ATLAS_COLUMNS * cell_size;
+	atlas->height = ATLAS_ROWS * cell_size;
+	atlas->cell_width = cell_size;
+	atlas->cell_height = cell_size;
+	atlas->columns = ATLAS_COLUMNS;
+
+	return pixels;
+
+CleanupExit:
+
+	free (planes);
+	free (scaled);
+	free (temp);
+	free (pixels);
+
+	return NULL;
+}
+
+static size_t BenchRender (PMATRIX matrix, const GLYPH_ATLAS *atlas, int phosphor)
+{
+	if (phosphor)
+		return RenderPhosphor (matrix, atlas, phosphor);
+
+	return RenderMatrix (matrix, atlas);
+}
+
+static int BenchRun (const BENCH_SCENARIO *scenario, const BENCH_OPTIONS *options, const GLYPH_ATLAS *atlas, int is_first)
+{
+	BENCH_ALLOCATOR allocator = {0};
+	MATRIX_HOOKS hooks = {0};
+	PDIRTY_REGION dirty;
+	PMATRIX matrix;
+	double update_time = 0.0;
+	double render_time = 0.0;
+	double start;
+	double middle;
+	double cells;
+	double ticks_per_sec;
+	double target;
+	uint64_t dirty_cells = 0;
+	uint64_t dirty_rects = 0;
+	uint64_t present_bytes = 0;
+	uint64_t full_presents = 0;
+	size_t allocations;
+
+	hooks.allocate = &BenchAllocate;
+	hooks.free = &BenchFree;
+	hooks.context = &allocator;
+
+	matrix = CreateMatrix (scenario->width, scenario->height, scenario->cell_size, options->seed, &hooks);
+
+	if (!matrix)
+		return 0;
+
+	if (!CreateMatrixFramebuffer (matrix))
+	{
+		DestroyMatrix (matrix);
+		return 0;
+	}
+
+	matrix->amount = scenario->amount;
+	matrix->density = scenario->density;
+
+	dirty = &matrix->framebuffer->dirty;
+
+	for (int i = 0; i < options->warmup; i++)
+	{
+		UpdateMatrixColumns (matrix, 0, matrix->numcols);
+		BenchRender (matrix, atlas, scenario->phosphor);
+	}
+
+	allocations = allocator.count;
+
+	for (int i = 0; i < options->ticks; i++)
+	{
+		start = BenchTime ();
+
+		UpdateMatrixColumns (matrix, 0, matrix->numcols);
+
+		middle = BenchTime ();
+
+		dirty_cells += BenchRender (matrix, atlas, scenario->phosphor);
+
+		render_time += BenchTime () - middle;
+		update_time += middle - start;
+
+		if (dirty->is_full)
+		{
+			full_presents += 1;
+			present_bytes += (uint64_t)matrix->width * matrix->height * sizeof (uint32_t);
+		}
+		else
+		{
+			dirty_rects += (uint64_t)dirty->count;
+
+			for (int j = 0; j < dirty->count; j++)
+				present_bytes += (uint64_t)(dirty->rect[j].right - dirty->rect[j].left) * (dirty->rect[j].bottom - dirty->rect[j].top) * sizeof (uint32_t);
+		}
+	}
+
+	allocations = allocator.count - allocations;
+
+	cells = (double)matrix->numcols * matrix->numrows;
+	ticks_per_sec = options->ticks / (update_time + render_time);
+	target = 1000.0 / MatrixStepTime (scenario->speed);
+
+	printf ("%s\n\t\t{\n", is_first ? "" : ",");
+	printf ("\t\t\t\"name\": \"%s\",\n", scenario->name);
+	printf ("\t\t\t\"width\": %d,\n", scenario->width);
+	printf ("\t\t\t\"height\": %d,\n", scenario->height);
+	printf ("\t\t\t\"columns\": %d,\n", matrix->numcols);
+	printf ("\t\t\t\"rows\": %d,\n", matrix->numrows);
+	printf ("\t\t\t\"cell_size\": %d,\n", matrix->cell_width);
+	printf ("\t\t\t\"amount\": %d,\n", scenario->amount);
+	printf ("\t\t\t\"density\": %d,\n", scenario->density);
+	printf ("\t\t\t\"speed\": %d,\n", scenario->speed);
+	printf ("\t\t\t\"phosphor\": %d,\n", scenario->phosphor);
+	printf ("\t\t\t\"ticks_per_sec\": %.1f,\n", ticks_per_sec);
+	printf ("\t\t\t\"cells_per_sec\": %.0f,\n", cells * ticks_per_sec);
+	printf ("\t\t\t\"update_us_per_tick\": %.2f,\n", update_time * 1e6 / options->ticks);
+	printf ("\t\t\t\"render_us_per_tick\": %.2f,\n", render_time * 1e6 / options->ticks);
+	printf ("\t\t\t\"dirty_cells_per_frame\": %.1f,\n", (double)dirty_cells / options->ticks);
+	printf ("\t\t\t\"dirty_rects_per_frame\": %.1f,\n", (double)dirty_rects / options->ticks);
+	printf ("\t\t\t\"full_presents\": %llu,\n", (unsigned long long)full_presents);
+	printf ("\t\t\t\"bytes_written_per_frame\": %.0f,\n", (double)dirty_cells * matrix->cell_width * matrix->cell_height * sizeof (uint32_t) / options->ticks);
+	printf ("\t\t\t\"present_bytes_per_frame\": %.0f,\n", (double)present_bytes / options->ticks);
+	printf ("\t\t\t\"allocations_per_frame\": %.3f,\n", (double)allocations / options->ticks);
+	printf ("\t\t\t\"target_ticks_per_sec\": %.1f,\n", target);
+	printf ("\t\t\t\"realtime_headroom\": %.2f\n", ticks_per_sec / target);
+	printf ("\t\t}");
+
+	DestroyMatrix (matrix);
+
+	return 1;
+}
+
+static const char *BenchFeatures (void)
+{
+	uint32_t features = CpuGetFeatures ();
+
+	if (features & CPU_FEATURE_AVX2)
+		return "avx2";
+
+	if (features & CPU_FEATURE_SSE2)
+		return "sse2";
+
+	return "scalar";
+}
+
+int main (int argc, char **argv)
+{
+	BENCH_OPTIONS options = {300, 100, 1, NULL};
+	int is_first = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp (argv[i], "--ticks") && i + 1 < argc)
+		{
+			options.ticks = atoi (argv[++i]);
+		}
+		else if (!strcmp (argv[i], "--warmup") && i + 1 < argc)
+		{
+			options.warmup = atoi (argv[++i]);
+		}
+		else if (!strcmp (argv[i], "--seed") && i + 1 < argc)
+		{
+			options.seed = strtoull (argv[++i], NULL, 0);
+		}
+		else if (!strcmp (argv[i], "--filter") && i + 1 < argc)
+		{
+			options.filter = argv[++i];
+		}
+		else
+		{
+			fprintf (stderr, "usage: %s [--ticks N] [--warmup N] [--seed N] [--filter TEXT]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// a zero seed would pick a random one
+	if (options.ticks < 1 || !options.seed)
+	{
+		fprintf (stderr, "ticks and seed must be positive\n");
+		return 2;
+	}
+
+	printf ("{\n");
+	printf ("\t\"seed\": %llu,\n", (unsigned long long)options.seed);
+	printf ("\t\"ticks\": %d,\n", options.ticks);
+	printf ("\t\"warmup\": %d,\n", options.warmup);
+	printf ("\t\"cpu\": \"%s\",\n", BenchFeatures ());
+	printf ("\t\"scenarios\": [");
+
+	for (size_t i = 0; i < sizeof (scenarios) / sizeof (scenarios[0]); i++)
+	{
+		GLYPH_ATLAS atlas;
+		uint32_t *pixels;
+
+		if (options.filter && !strstr (scenarios[i].name, options.filter))
+			continue;
+
+		pixels = BenchCreateAtlas (&atlas, MatrixCellSize (scenarios[i].cell_size));
+
+		if (!pixels)
+			return 1;
+
+		if (BenchRun (&scenarios[i], &options, &atlas, is_first))
+			is_first = 0;
+
+		free (pixels);
+
+		fflush (stdout);
+	}
+
+	printf ("\n\t]\n}\n");
+
+	return 0;
+}
@@ -0,0 +1,311 @@
+// Matrix Screensaver
+// Copyright (c) 2011-2021 Henry++
+//
+// Offline renderer, streams frames as fast as they are simulated.
+//
+//	matrix_render [--size WxH] [--frames N] [--seed N] [--hue N]
+//		[--speed N] [--amount N] [--density N] [--cell N]
+//		[--phosphor N] [--format y4m|rgb] [--glyphs FILE] [OUTPUT]
+//
+// The output defaults to stdout, for example
+//
+//	matrix_render --size 1920x1080 --frames 1200 | ffmpeg -i - loop.mp4
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/atlas.h"
+#include "core/matrix.h"
+#include "core/phosphor.h"
+#include "core/recolor.h"
+#include "core/render.h"
+#include "core/scale.h"
+#include "core/video.h"
+
+#ifndef MATRIX_GLYPH_PATH
+#define MATRIX_GLYPH_PATH "glyph.bmp"
+#endif
+
+typedef struct _RENDER_OPTIONS
+{
+	int width;
+	int height;
+	int frames;
+	int hue;
+	int speed;
+	int amount;
+	int density;
+	int cell_size;
+	int phosphor; // decay of the trails, zero for none
+
+	uint64_t seed;
+
+	VIDEO_FORMAT format;
+
+	const char *glyphs;
+	const char *output;
+} RENDER_OPTIONS, *PRENDER_OPTIONS;
+
+//
+//	Loads the 8-bit glyph bitmap, scales it to the cell size and recolors
+//	it the same way the screensaver does, the atlas is returned top-down.
+//
+static uint32_t *LoadGlyphAtlas (const char *path, int hue, int cell_size, PGLYPH_ATLAS atlas)
+{
+	uint8_t *data = NULL;
+	uint8_t *planes = NULL;
+	uint8_t *scaled = NULL;
+	uint8_t *temp = NULL;
+	uint32_t *pixels = NULL;
+	size_t size;
+	size_t count;
+	size_t scaled_count;
+	long length;
+	int columns;
+	int rows;
+	FILE *file;
+
+	file = fopen (path, "rb");
+
+	if (!file)
+		return NULL;
+
+	if (fseek (file, 0, SEEK_END) || (length = ftell (file)) < 0 || fseek (file, 0, SEEK_SET))
+		goto CleanupExit;
+
+	size = (size_t)length;
+	data = malloc (size ? size : 1);
+
+	if (!data || fread (data, 1, size, file) != size)
+		goto CleanupExit;
+
+	if (!GlyphBitmapSize (data, size, &columns, &rows))
+		goto CleanupExit;
+
+	count = (size_t)columns * GLYPH_WIDTH * rows * GLYPH_HEIGHT;
+	scaled_count = (size_t)columns * cell_size * rows * cell_size;
+
+	planes = malloc (count * 2);
+	scaled = malloc (scaled_count * 2);
+	temp = malloc (ScaleCellsTempSize (columns, rows, GLYPH_HEIGHT, cell_size));
+	pixels = malloc (scaled_count * sizeof (uint32_t));
+
+	if (!planes || !scaled || !temp || !pixels)
+	{
+		free (pixels);
+		pixels = NULL;
+
+		goto CleanupExit;
+	}
+
+	DecodeGlyphBitmap (data, planes, planes + count);
+
+	if (!ScaleCells (scaled, planes, temp, columns, rows, GLYPH_WIDTH, GLYPH_HEIGHT, cell_size, cell_size) ||
+		!ScaleCells (scaled + scaled_count, planes + count, temp, columns, rows, GLYPH_WIDTH, GLYPH_HEIGHT, cell_size, cell_size))
+	{
+		free (pixels);
+		pixels = NULL;
+
+		goto CleanupExit;
+	}
+
+	RecolorPixels (pixels, scaled, scaled + scaled_count, scaled_count, hue % HLS_MAX);
+
+	atlas->pixels = pixels;
+	atlas->stride = (ptrdiff_t)columns * cell_size;
+	atlas->width = columns * cell_size;
+	atlas->height = rows * cell_size;
+	atlas->cell_width = cell_size;
+	atlas->cell_height = cell_size;
+	atlas->columns = columns;
+
+CleanupExit:
+
+	free (temp);
+	free (scaled);
+	free (planes);
+	free (data);
+
+	fclose (file);
+
+	return pixels;
+}
+
+static bool WriteFileSink (void *context, const void *data, size_t size)
+{
+	return fwrite (data, 1, size, (FILE *)context) == size;
+}
+
+static int ParseOptions (int argc, char **argv, PRENDER_OPTIONS options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (!strcmp (argv[i], "--size") && value)
+		{
+			if (sscanf (value, "%dx%d", &options->width, &options->height) != 2)
+				return 0;
+		}
+		else if (!strcmp (argv[i], "--frames") && value)
+		{
+			options->frames = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--seed") && value)
+		{
+			options->seed = strtoull (value, NULL, 0);
+		}
+		else if (!strcmp (argv[i], "--hue") && value)
+		{
+			options->hue = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--speed") && value)
+		{
+			options->speed = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--amount") && value)
+		{
+			options->amount = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--density") && value)
+		{
+			options->density = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--cell") && value)
+		{
+			options->cell_size = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--phosphor") && value)
+		{
+			options->phosphor = atoi (value);
+		}
+		else if (!strcmp (argv[i], "--format") && value)
+		{
+			if (!strcmp (value, "y4m"))
+			{
+				options->format = VIDEO_FORMAT_Y4M;
+			}
+			else if (!strcmp (value, "rgb"))
+			{
+				options->format = VIDEO_FORMAT_RGB24;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		else if (!strcmp (argv[i], "--glyphs") && value)
+		{
+			options->glyphs = value;
+		}
+		else if (argv[i][0] != '-' || !strcmp (argv[i], "-"))
+		{
+			options->output = argv[i];
+			continue;
+		}
+		else
+		{
+			return 0;
+		}
+
+		i += 1;
+	}
+
+	return (options->width > 0 && options->height > 0 && options->frames > 0 && options->speed >= SPEED_MIN && options->speed <= SPEED_MAX && options->amount >= AMOUNT_MIN && options->amount <= AMOUNT_MAX && options->density >= DENSITY_MIN && options->density <= DENSITY_MAX && options->cell_size >= CELL_SIZE_MIN && options->cell_size <= CELL_SIZE_MAX && options->phosphor >= 0 && options->phosphor <= PHOSPHOR_DECAY_MAX);
+}
+
+int main (int argc, char **argv)
+{
+	RENDER_OPTIONS options = {1920, 1080, 600, 85, SPEED_DEFAULT, AMOUNT_DEFAULT, DENSITY_DEFAULT, CELL_SIZE_DEFAULT, 0, 1, VIDEO_FORMAT_Y4M, MATRIX_GLYPH_PATH, "-"};
+	VIDEO_WRITER writer;
+	GLYPH_ATLAS atlas;
+	PMATRIX matrix = NULL;
+	uint32_t *pixels;
+	uint8_t *buffer = NULL;
+	uint8_t *frame = NULL;
+	FILE *file;
+	int status = 1;
+
+	if (!ParseOptions (argc, argv, &options))
+	{
+		fprintf (stderr, "usage: %s [--size WxH] [--frames N] [--seed N] [--hue N] [--speed N] [--amount N] [--density N] [--cell N] [--phosphor N] [--format y4m|rgb] [--glyphs FILE] [OUTPUT]\n", argv[0]);
+		return 2;
+	}
+
+	pixels = LoadGlyphAtlas (options.glyphs, options.hue, options.cell_size, &atlas);
+
+	if (!pixels)
+	{
+		fprintf (stderr, "cannot load %s\n", options.glyphs);
+		return 1;
+	}
+
+	// the amount stays within the glyphs of the bitmap
+	if (options.amount > atlas.columns * ((atlas.height / atlas.cell_height) / ATLAS_LEVELS))
+		options.amount = atlas.columns * ((atlas.height / atlas.cell_height) / ATLAS_LEVELS);
+
+	file = strcmp (options.output, "-") ? fopen (options.output, "wb") : stdout;
+
+	if (!file)
+	{
+		fprintf (stderr, "cannot create %s\n", options.output);
+		free (pixels);
+
+		return 1;
+	}
+
+	// the writer does its own buffering
+	setvbuf (file, NULL, _IONBF, 0);
+
+	matrix = CreateMatrix (options.width, options.height, options.cell_size, options.seed, NULL);
+
+	if (!matrix || !CreateMatrixFramebuffer (matrix))
+		goto CleanupExit;
+
+	matrix->amount = options.amount;
+	matrix->density = options.density;
+
+	frame = malloc (VideoFrameSize (options.format, options.width, options.height));
+	buffer = malloc (VIDEO_BUFFER_DEFAULT);
+
+	if (!frame || !buffer)
+		goto CleanupExit;
+
+	if (!VideoInit (&writer, options.format, options.width, options.height, 1000, MatrixStepTime (options.speed), frame, buffer, VIDEO_BUFFER_DEFAULT, &WriteFileSink, file))
+		goto CleanupExit;
+
+	for (int i = 0; i < options.frames; i++)
+	{
+		UpdateMatrixColumns (matrix, 0, matrix->numcols);
+
+		if (options.phosphor)
+			RenderPhosphor (matrix, &atlas, options.phosphor);
+		else
+			RenderMatrix (matrix, &atlas);
+
+		if (!VideoWriteFrame (&writer, matrix->framebuffer))
+			goto CleanupExit;
+	}
+
+	if (VideoFlush (&writer))
+		status = 0;
+
+CleanupExit:
+
+	if (status)
+		fprintf (stderr, "rendering failed\n");
+
+	if (matrix)
+		DestroyMatrix (matrix);
+
+	free (buffer);
+	free (frame);
+	free (pixels);
+
+	if (file != stdout)
+		fclose (file);
+
+	return status;
+}